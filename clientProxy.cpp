@@ -1,10 +1,18 @@
 #include "waterServer.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 
+#include <algorithm>
+#include <vector>
 #include <boost/thread/scoped_thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/optional.hpp>
 #include <boost/foreach.hpp>
 //#include <boost/static_assert.hpp>
@@ -12,168 +20,380 @@
 namespace waterServer
 {
 
-class Slave : public GuiProxy::Callback
+// Poll loop state of one slave. All slaves live in one contiguous table which the
+// poll thread scans; control requests access it under ClientProxyImpl::stateMtx.
+struct SlaveState
+{
+	water::Reply replyToSend; // valid if hasReplyToSend, kept until slave acknowledges it with next request
+	boost::posix_time::ptime lastPollTime;
+	uint32_t readErrors;
+	uint32_t writeErrors;
+	uint32_t badRequests;
+	WaterClient::SlaveId id;
+	WaterClient::RequestSeqNum lastReceivedSeqNum;
+	uint8_t replyWriteAttempts; // failed in a row
+	uint8_t replyWrites; // succeeded, slave may miss a written reply
+	bool hasReplyToSend;
+	bool replyWritten;
+	bool processingInGui;
+	bool paused;
+};
+
+// Reply handed over from GUI thread, guarded by ClientProxyImpl::replyMtx.
+struct ReplySlot
+{
+	water::Reply reply;
+	bool present;
+	uint32_t guiErrors;
+};
+
+// How late the poll thread wakes up compared to the slot it asked for, in power of two
+// microsecond buckets: bucket 0 is on time, bucket n is below 2^n us, last one is the rest.
+class JitterHistogram
 {
 public:
 
-	Slave(WaterClient::SlaveId idArg) :
-		id(idArg), processingInGui(false), lastReceivedSeqNum(0)
-	{}
+	JitterHistogram() { this->reset(); }
+
+	void record(boost::posix_time::time_duration lateness);
+	void reset();
+	void dump(std::ostream &) const;
+
+private:
+
+	static unsigned const BUCKETS = 24;
+
+	unsigned long counts[BUCKETS];
+	unsigned long samples;
+	int64_t maxUs;
+};
+
+void
+JitterHistogram::record(boost::posix_time::time_duration const lateness)
+{
+	int64_t const us = lateness.total_microseconds();
+	unsigned bucket = 0;
+	while (bucket < BUCKETS - 1 && us >= (int64_t(1) << bucket)) ++bucket;
+
+	++this->counts[bucket];
+	++this->samples;
+	if (us > this->maxUs) this->maxUs = us;
+}
 
-	Slave(Slave && other) :
-		replyToSendProtected(std::move(other.replyToSendProtected)),
-		replyToSend(std::move(other.replyToSend)),
-		id(other.id), processingInGui(other.processingInGui),
-		lastReceivedSeqNum(other.lastReceivedSeqNum)
+void
+JitterHistogram::reset()
+{
+	std::fill(this->counts, this->counts + BUCKETS, 0);
+	this->samples = 0;
+	this->maxUs = 0;
+}
+
+void
+JitterHistogram::dump(std::ostream & osek) const
+{
+	osek << "poll wake up lateness, samples:" << this->samples << " maxUs:" << this->maxUs << "\n";
+	for (unsigned bucket = 0; bucket < BUCKETS; ++bucket)
 	{
+		if (this->counts[bucket] == 0) continue;
+		if (bucket == 0) osek << "<1us";
+		else if (bucket == BUCKETS - 1) osek << ">=" << (int64_t(1) << (bucket - 1)) << "us";
+		else osek << "<" << (int64_t(1) << bucket) << "us";
+		osek << " " << this->counts[bucket] << "\n";
 	}
+}
 
-	~Slave() = default;
+class ClientProxyImpl;
 
-	std::unique_ptr<WaterClient::Request> readRequest(ModbusServer &);
+// Callback given to GuiProxy, just points back to slave's row in the table.
+class SlaveHandle : public GuiProxy::Callback
+{
+public:
 
-	template <class T> static void readWriteRequest(T &, T);
-	template <class T> static void readWriteReply(T, T &);
+	SlaveHandle(ClientProxyImpl & ownerArg, uint32_t indexArg) :
+		owner(ownerArg), index(indexArg)
+	{}
 
 private:
 
-	boost::mutex mtx;
-	std::unique_ptr<water::Reply> replyToSendProtected;
-	std::unique_ptr<water::Reply> replyToSend;
-
-	WaterClient::SlaveId id;
-	bool processingInGui;
-	WaterClient::RequestSeqNum lastReceivedSeqNum;
+	ClientProxyImpl & owner;
+	uint32_t const index;
 
 	virtual void serverInternalError();
 	virtual void notFound();
 	virtual void success(WaterClient::Credit creditAvail);
+	virtual void timeout();
+	virtual RequestTrace * trace();
+};
 
-	void setReply(
-		WaterClient::LoginReply::Status,
-		WaterClient::Credit creditAvail = 0);
-
-	static char buffer[SEND_BUFFER_SIZE_BYTES];
+// serialization policy for water::serializeRequest and water::serializeReply
+struct Serializer
+{
+	template <class T> static void readWriteRequest(T &, T);
+	template <class T> static void readWriteReply(T, T &);
 };
 
 class ClientProxyImpl : public ClientProxy
 {
 	virtual void run();
+	virtual void runUntil(boost::posix_time::ptime deadline);
 
 public:
 
-	ClientProxyImpl(GuiProxy &, ModbusServer &, std::list<WaterClient::SlaveId> const &);
+	ClientProxyImpl(GuiProxy &, ModbusServer &, std::list<WaterClient::SlaveId> const &, ClientProxy::Config const &);
+
+	virtual void pollRound();
+	virtual void dumpSlaves(std::ostream &);
+	virtual bool pollNow(WaterClient::SlaveId);
+	virtual bool setPaused(WaterClient::SlaveId, bool paused);
+	virtual void dumpJitter(std::ostream &);
+	virtual void resetJitter();
+
+	// called from GUI thread through SlaveHandle
+	void setReply(
+		uint32_t index,
+		WaterClient::LoginReply::Status,
+		WaterClient::Credit creditAvail = 0);
+	RequestTrace * trace(uint32_t index);
 
 private:
 
 	GuiProxy & guiProxy;
 	ModbusServer & modbusServer;
-	std::list<Slave> slaves;
-
-	void processSlave(Slave &);
+	Clock & clock;
+	boost::posix_time::time_duration const pollInterval;
+	int const cpu;
+	int const realtimePriority;
+	bool const lockMemory;
+
+	std::vector<SlaveState> slaves;
+	std::vector<SlaveHandle> handles;
+	std::vector<RequestTrace> traces; // empty unless tracing, GUI stamps them while processingInGui
+
+	boost::mutex replyMtx;
+	std::vector<ReplySlot> replies;
+
+	// guards slaves state against control requests, held while a slave is being processed
+	boost::mutex stateMtx;
+	boost::condition wakeUp;
+	std::list<WaterClient::SlaveId> forcedPolls;
+	unsigned long throttledReads; // request reads skipped because GUI was overloaded
+	JitterHistogram jitter;
+
+	char buffer[SEND_BUFFER_SIZE_BYTES];
+
+	int findSlave(WaterClient::SlaveId) const;
+	bool readRequest(uint32_t index, WaterClient::Request &);
+	void processSlave(uint32_t index);
+	void dumpSlave(uint32_t index, std::ostream &);
+	void waitForNextSlot();
+	void setUpPollThread();
+
+	static unsigned const MAX_REPLY_WRITE_ATTEMPTS = 3;
+	static unsigned const MAX_REPLY_WRITES = 3;
 };
 
-char Slave::buffer[SEND_BUFFER_SIZE_BYTES];
-
-std::unique_ptr<WaterClient::Request>
-Slave::readRequest(ModbusServer & ms)
+bool
+ClientProxyImpl::readRequest(uint32_t const index, WaterClient::Request & rq)
 {
-	ms.setSlave(this->id);
+	SlaveState & slave = this->slaves[index];
+	RequestTrace * const trace = this->traces.empty() ? nullptr : &this->traces[index];
 
-	if (this->processingInGui)
+	this->modbusServer.setSlave(slave.id);
+	int64_t const pollStartUs = trace != nullptr ? Tracer::NowUs() : 0;
+	slave.lastPollTime = this->clock.now();
+
+	if (slave.processingInGui)
 	{
-		boost::mutex::scoped_lock lck(this->mtx);
-		if (this->replyToSendProtected.get() != nullptr)
+		boost::mutex::scoped_lock lck(this->replyMtx);
+		ReplySlot & slot = this->replies[index];
+		if (slot.present)
 		{
-			this->replyToSend = std::move(this->replyToSendProtected);
-			this->processingInGui = false;
+			slave.replyToSend = slot.reply;
+			slave.hasReplyToSend = true;
+			slave.replyWritten = false;
+			slave.replyWriteAttempts = 0;
+			slave.replyWrites = 0;
+			slave.processingInGui = false;
+			slot.present = false;
+			if (trace != nullptr) trace->stamp(RequestTrace::REPLY_PICKED_UP);
 		}
 	}
 
-	if (this->replyToSend.get())
+	// reply stays in slave registers once written, so it is written only until it succeeds
+	// and, from cache, a few more times while slave still shows the answered request
+	bool const writingReply = slave.hasReplyToSend && !slave.replyWritten;
+	if (writingReply)
 	{
-		DLOG("sending reply to slave num " << +this->id);
-		water::serializeReply<Slave>(*this->replyToSend, Slave::buffer);
-		ms.writeRegisters(
-			REPLY_ADDRESS, SEND_BUFFER_SIZE_BYTES/2, reinterpret_cast<uint16_t*>(Slave::buffer));
-//		else
-//		{
-//			DLOG("success writing reply:" << *this->replyToSend);
-//		}
+		DLOG("sending reply to slave num " << +slave.id);
+		water::serializeReply<Serializer>(slave.replyToSend, this->buffer);
+		auto const rc = this->modbusServer.writeRegisters(
+			REPLY_ADDRESS, SEND_BUFFER_SIZE_BYTES/2, reinterpret_cast<uint16_t*>(this->buffer));
+		if (rc == -1)
+		{
+			++slave.writeErrors;
+			if (++slave.replyWriteAttempts >= MAX_REPLY_WRITE_ATTEMPTS)
+			{
+				ELOG("giving up sending reply to slave num " << +slave.id << " after "
+					<< +slave.replyWriteAttempts << " attempts, reply:" << slave.replyToSend);
+				slave.hasReplyToSend = false;
+			}
+		}
+		else
+		{
+			slave.replyWritten = true;
+			if (++slave.replyWrites == 1 && trace != nullptr)
+			{
+				trace->stamp(RequestTrace::REPLY_WRITTEN);
+				Tracer::Finish(*trace);
+			}
+		}
 	}
 
-	if (this->processingInGui)
+	if (slave.processingInGui)
 	{
-		DLOG("skipped processing slave num " << +this->id << " because its request is being handled in GUI");
-		return std::unique_ptr<WaterClient::Request>();
+		DLOG("skipped processing slave num " << +slave.id << " because its request is being handled in GUI");
+		return false;
 	}
 
-	DLOG("trying to read request from slave:" << +this->id);
+	// request waits in slave registers until GUI queue drains, replies above still go out
+	if (this->guiProxy.isOverloaded())
+	{
+		DLOG("GUI overloaded, not reading request from slave num " << +slave.id);
+		++this->throttledReads;
+		return false;
+	}
 
-	auto rc = ms.readRegisters(REQUEST_ADDRESS, SEND_BUFFER_SIZE_BYTES/2, reinterpret_cast<uint16_t*>(Slave::buffer));
+	DLOG("trying to read request from slave:" << +slave.id);
+
+	auto rc = this->modbusServer.readRegisters(
+		REQUEST_ADDRESS, SEND_BUFFER_SIZE_BYTES/2, reinterpret_cast<uint16_t*>(this->buffer));
 	if (rc == -1)
 	{
-		return std::unique_ptr<WaterClient::Request>();
+		++slave.readErrors;
+		return false;
 	}
 
-	std::unique_ptr<water::WaterClient::Request> rq{new water::WaterClient::Request()};
-	bool const serializeSuccess = water::serializeRequest<Slave>(*rq, Slave::buffer);
+	bool const serializeSuccess = water::serializeRequest<Serializer>(rq, this->buffer);
 	if (!serializeSuccess)
 	{
 		ELOG("failed to serialize request");
-		return std::unique_ptr<WaterClient::Request>();
+		++slave.badRequests;
+		return false;
 	}
 
-	if (rq->requestSeqNumAtBegin != rq->requestSeqNumAtEnd)
+	if (rq.requestSeqNumAtBegin != rq.requestSeqNumAtEnd)
 	{
 		ELOG("request ignored because seq nums do not match, start:"
-			<< +rq->requestSeqNumAtBegin << ", end:" << +rq->requestSeqNumAtEnd);
-		return std::unique_ptr<WaterClient::Request>();
+			<< +rq.requestSeqNumAtBegin << ", end:" << +rq.requestSeqNumAtEnd);
+		++slave.badRequests;
+		return false;
 	}
 
-	DLOG("request from slave num " << (+this->id) << " is " << *rq);
-	if (rq->requestSeqNumAtBegin == this->lastReceivedSeqNum)
+	DLOG("request from slave num " << (+slave.id) << " is " << rq);
+	if (rq.requestSeqNumAtBegin == slave.lastReceivedSeqNum)
 	{
-		DLOG("ignoring already received message with seqNum:" << this->lastReceivedSeqNum);
-		return std::unique_ptr<WaterClient::Request>();
+		// idle slave keeps showing its last request, so an answered request is never sent to GUI
+		// again; its reply may have been missed though, so it is rewritten from cache a few times
+		if (slave.hasReplyToSend && slave.replyWritten && !writingReply && slave.replyWrites < MAX_REPLY_WRITES)
+		{
+			DLOG("slave num " << +slave.id << " still shows answered request, writing its reply again");
+			slave.replyWritten = false;
+		}
+		DLOG("ignoring already received message with seqNum:" << +slave.lastReceivedSeqNum);
+		return false;
 	}
 
-	this->lastReceivedSeqNum = rq->requestSeqNumAtBegin;
-	this->processingInGui = true;
+	if (slave.hasReplyToSend)
+	{
+		// new request means previous reply has been consumed
+		DLOG("reply acknowledged by slave num " << +slave.id << ", written:" << slave.replyWritten);
+		slave.hasReplyToSend = false;
+	}
+
+	slave.lastReceivedSeqNum = rq.requestSeqNumAtBegin;
+	slave.processingInGui = true;
+	if (trace != nullptr) Tracer::Start(*trace, slave.id, pollStartUs);
 
-	return std::move(rq);
+	return true;
 }
 
-void Slave::setReply(
+void
+ClientProxyImpl::setReply(
+	uint32_t const index,
 	WaterClient::LoginReply::Status const status,
 	WaterClient::Credit const creditAvail)
 {
-	std::unique_ptr<water::Reply> reply{ new water::Reply{
-		this->lastReceivedSeqNum,
-		WaterClient::LoginReply{status, creditAvail},
-		this->lastReceivedSeqNum}};
+	// written by poll thread before request was handed to GUI
+	WaterClient::RequestSeqNum const seqNum = this->slaves[index].lastReceivedSeqNum;
+
+	boost::mutex::scoped_lock lck(this->replyMtx);
+	ReplySlot & slot = this->replies[index];
+	BOOST_ASSERT_MSG(!slot.present, "reply came while previus was not yet delivered");
 
+	slot.reply = water::Reply{seqNum, WaterClient::LoginReply{status, creditAvail}, seqNum};
+	slot.present = true;
+	if (status == WaterClient::LoginReply::Status::SERVER_INTERNAL_ERROR) ++slot.guiErrors;
+	if (!this->traces.empty()) this->traces[index].stamp(RequestTrace::REPLY_SET);
+}
+
+RequestTrace *
+ClientProxyImpl::trace(uint32_t const index)
+{
+	if (this->traces.empty() || this->traces[index].id == 0) return nullptr;
+	return &this->traces[index];
+}
+
+void
+ClientProxyImpl::dumpSlave(uint32_t const index, std::ostream & osek)
+{
+	SlaveState const & slave = this->slaves[index];
+
+	ReplySlot slot;
 	{
-		boost::mutex::scoped_lock lck(this->mtx);
-		this->replyToSendProtected.swap(reply);
+		boost::mutex::scoped_lock lck(this->replyMtx);
+		slot = this->replies[index];
 	}
 
-	BOOST_ASSERT_MSG(reply.get() == nullptr, "reply came while previus was not yet delivered");
+	osek << "slave:" << +slave.id
+		<< " processingInGui:" << slave.processingInGui
+		<< " replyCame:" << slot.present
+		<< " replyUnacked:" << slave.hasReplyToSend
+		<< " replyWritten:" << slave.replyWritten
+		<< " replyWrites:" << +slave.replyWrites
+		<< " paused:" << slave.paused
+		<< " lastSeqNum:" << +slave.lastReceivedSeqNum
+		<< " lastPoll:" << (slave.lastPollTime.is_not_a_date_time() ? std::string("never") :
+			boost::posix_time::to_simple_string(
+				boost::posix_time::microsec_clock::local_time() - (this->clock.now() - slave.lastPollTime)))
+		<< " readErrors:" << slave.readErrors
+		<< " writeErrors:" << slave.writeErrors
+		<< " badRequests:" << slave.badRequests
+		<< " guiErrors:" << slot.guiErrors << "\n";
+}
+
+void SlaveHandle::serverInternalError()
+{
+	this->owner.setReply(this->index, WaterClient::LoginReply::Status::SERVER_INTERNAL_ERROR);
+}
+
+void SlaveHandle::notFound()
+{
+	this->owner.setReply(this->index, WaterClient::LoginReply::Status::NOT_FOUND);
 }
 
-void Slave::serverInternalError()
+void SlaveHandle::success(WaterClient::Credit const creditAvail)
 {
-	this->setReply(WaterClient::LoginReply::Status::SERVER_INTERNAL_ERROR);
+	this->owner.setReply(this->index, WaterClient::LoginReply::Status::SUCCESS, creditAvail);
 }
 
-void Slave::notFound()
+void SlaveHandle::timeout()
 {
-	this->setReply(WaterClient::LoginReply::Status::NOT_FOUND);
+	this->owner.setReply(this->index, WaterClient::LoginReply::Status::TIMEOUT);
 }
 
-void Slave::success(WaterClient::Credit const creditAvail)
+RequestTrace * SlaveHandle::trace()
 {
-	this->setReply(WaterClient::LoginReply::Status::SUCCESS, creditAvail);
+	return this->owner.trace(this->index);
 }
 
 std::ostream & operator<<(std::ostream & osek, WaterClient::Request const & rq)
@@ -215,13 +435,29 @@ std::ostream & operator<<(std::ostream & osek, water::Reply const & reply)
 }
 
 ClientProxyImpl::ClientProxyImpl(
-	GuiProxy & guiProxyArg, ModbusServer & modbusServerArg, std::list<WaterClient::SlaveId> const & slaveIdsArg) :
+	GuiProxy & guiProxyArg, ModbusServer & modbusServerArg, std::list<WaterClient::SlaveId> const & slaveIdsArg,
+	ClientProxy::Config const & config) :
 	guiProxy(guiProxyArg),
-	modbusServer(modbusServerArg)
+	modbusServer(modbusServerArg),
+	clock(config.clock != nullptr ? *config.clock : Clock::Real()),
+	pollInterval(boost::posix_time::milliseconds(config.pollIntervalMs)),
+	cpu(config.cpu),
+	realtimePriority(config.realtimePriority),
+	lockMemory(config.lockMemory),
+	throttledReads(0)
 {
+	// tables are never resized later, GUI keeps pointers to handles
+	this->slaves.reserve(slaveIdsArg.size());
+	this->handles.reserve(slaveIdsArg.size());
+	this->replies.resize(slaveIdsArg.size(), ReplySlot());
+	if (Tracer::Enabled()) this->traces.resize(slaveIdsArg.size(), RequestTrace());
+
 	BOOST_FOREACH(WaterClient::SlaveId const slaveId, slaveIdsArg)
 	{
-		this->slaves.push_back(slaveId);
+		SlaveState slave = SlaveState();
+		slave.id = slaveId;
+		this->slaves.push_back(slave);
+		this->handles.emplace_back(*this, this->handles.size());
 	}
 
 	//BOOST_STATIC_ASSERT((sizeof(water::WaterClient::Request) + sizeof(uint16_t) - 1) / sizeof(uint16_t) == SEND_BUFFER_SIZE_BYTES/2);
@@ -230,61 +466,216 @@ ClientProxyImpl::ClientProxyImpl(
 void
 ClientProxyImpl::run()
 {
-	while (1)
+	this->setUpPollThread();
+	this->runUntil(boost::posix_time::ptime(boost::posix_time::pos_infin));
+}
+
+void
+ClientProxyImpl::runUntil(boost::posix_time::ptime const deadline)
+{
+	while (this->clock.now() < deadline)
+	{
+		bool anyProcessed = false;
+		for (uint32_t index = 0; index < this->slaves.size() && this->clock.now() < deadline; ++index)
+		{
+			{
+				boost::mutex::scoped_lock lck(this->stateMtx);
+				if (this->slaves[index].paused)
+				{
+					DLOG("slave num " << +this->slaves[index].id << " is paused");
+					continue;
+				}
+				this->processSlave(index);
+			}
+			anyProcessed = true;
+			this->waitForNextSlot();
+		}
+		if (!anyProcessed) this->waitForNextSlot();
+	}
+}
+
+// Keeps Modbus timing away from GUI worker, logging and other processes. Failures
+// (usually EPERM without CAP_SYS_NICE or CAP_IPC_LOCK) leave the thread as it was.
+void
+ClientProxyImpl::setUpPollThread()
+{
+	if (this->cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(this->cpu, &cpus);
+		int const rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (rc != 0) { WLOG("could not pin poll thread to cpu " << this->cpu << ", " << strerror(rc)); }
+		else { LOG("poll thread pinned to cpu " << this->cpu); }
+	}
+
+	if (this->realtimePriority > 0)
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = this->realtimePriority;
+		int const rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (rc != 0) { WLOG("could not set SCHED_FIFO priority " << this->realtimePriority << ", " << strerror(rc)); }
+		else { LOG("poll thread runs with SCHED_FIFO priority " << this->realtimePriority); }
+	}
+
+	if (this->lockMemory)
+	{
+		// whole process, GUI thread memory is locked as well
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) { WLOG("could not lock memory, " << strerror(errno)); }
+		else { LOG("process memory locked"); }
+	}
+}
+
+void
+ClientProxyImpl::pollRound()
+{
+	boost::mutex::scoped_lock lck(this->stateMtx);
+	for (uint32_t index = 0; index < this->slaves.size(); ++index)
 	{
-		BOOST_FOREACH(Slave & slave, this->slaves)
+		if (!this->slaves[index].paused) this->processSlave(index);
+	}
+}
+
+void
+ClientProxyImpl::waitForNextSlot()
+{
+	auto const deadline = this->clock.now() + this->pollInterval;
+
+	boost::mutex::scoped_lock lck(this->stateMtx);
+	bool slept = false;
+	while (this->clock.now() < deadline)
+	{
+		slept = false;
+		if (!this->forcedPolls.empty())
 		{
-			this->processSlave(slave);
-			boost::this_thread::sleep(boost::posix_time::seconds(5));
+			WaterClient::SlaveId const slaveId = this->forcedPolls.front();
+			this->forcedPolls.pop_front();
+
+			int const index = this->findSlave(slaveId);
+			if (index != -1)
+			{
+				LOG("forced poll of slave num " << +slaveId);
+				this->processSlave(index);
+			}
+			continue;
 		}
+		this->clock.sleepUntil(lck, this->wakeUp, deadline);
+		slept = true;
 	}
+
+	// forced polls running over the deadline are not scheduling jitter
+	if (slept) this->jitter.record(this->clock.now() - deadline);
+}
+
+void
+ClientProxyImpl::dumpJitter(std::ostream & osek)
+{
+	boost::mutex::scoped_lock lck(this->stateMtx);
+	this->jitter.dump(osek);
 }
 
 void
-ClientProxyImpl::processSlave(Slave & slave)
+ClientProxyImpl::resetJitter()
 {
-	auto requestPtr = slave.readRequest(this->modbusServer);
+	boost::mutex::scoped_lock lck(this->stateMtx);
+	this->jitter.reset();
+}
+
+int
+ClientProxyImpl::findSlave(WaterClient::SlaveId const slaveId) const
+{
+	for (uint32_t index = 0; index < this->slaves.size(); ++index)
+	{
+		if (this->slaves[index].id == slaveId) return index;
+	}
+	return -1;
+}
 
-	if (requestPtr.get() == nullptr)
+void
+ClientProxyImpl::dumpSlaves(std::ostream & osek)
+{
+	boost::mutex::scoped_lock lck(this->stateMtx);
+	osek << "slaves:" << this->slaves.size()
+		<< " guiOverloaded:" << this->guiProxy.isOverloaded()
+		<< " throttledReads:" << this->throttledReads << "\n";
+	for (uint32_t index = 0; index < this->slaves.size(); ++index)
+	{
+		this->dumpSlave(index, osek);
+	}
+}
+
+bool
+ClientProxyImpl::pollNow(WaterClient::SlaveId const slaveId)
+{
+	{
+		boost::mutex::scoped_lock lck(this->stateMtx);
+		if (this->findSlave(slaveId) == -1) return false;
+		this->forcedPolls.push_back(slaveId);
+	}
+	this->wakeUp.notify_one();
+	return true;
+}
+
+bool
+ClientProxyImpl::setPaused(WaterClient::SlaveId const slaveId, bool const paused)
+{
+	boost::mutex::scoped_lock lck(this->stateMtx);
+	int const index = this->findSlave(slaveId);
+	if (index == -1) return false;
+
+	LOG((paused ? "pausing" : "resuming") << " slave num " << +slaveId);
+	this->slaves[index].paused = paused;
+	return true;
+}
+
+void
+ClientProxyImpl::processSlave(uint32_t const index)
+{
+	WaterClient::Request request;
+	if (!this->readRequest(index, request))
 	{
 		return;
 	}
 
-	switch (requestPtr->requestType)
+	SlaveHandle * const callback = &this->handles[index];
+	switch (request.requestType)
 	{
 	case water::RequestType::LOGIN_BY_USER:
 		this->guiProxy.handleIdPinRequest(
-			requestPtr->impl.loginByUser.userId,
-			requestPtr->impl.loginByUser.pin,
-			requestPtr->consumeCredit, &slave);
+			request.impl.loginByUser.userId,
+			request.impl.loginByUser.pin,
+			request.consumeCredit, callback);
 		return;
 	case water::RequestType::LOGIN_BY_RFID:
 		this->guiProxy.handleRfidRequest(
-			requestPtr->impl.loginByRfid.rfidId,
-			requestPtr->consumeCredit, &slave);
+			request.impl.loginByRfid.rfidId,
+			request.consumeCredit, callback);
 		return;
 	}
 	BOOST_ASSERT_MSG(false, "wrong request type");
 }
 
 template <class T> void
-Slave::readWriteRequest(T & inMem, T const inBuffer)
+Serializer::readWriteRequest(T & inMem, T const inBuffer)
 {
 	inMem = inBuffer;
 }
 
 template <class T> void
-Slave::readWriteReply(T const inMem, T & inBuffer)
+Serializer::readWriteReply(T const inMem, T & inBuffer)
 {
 	inBuffer = inMem;
 }
 
 
 std::unique_ptr<ClientProxy>
-ClientProxy::CreateDefault(GuiProxy & guiProxy, ModbusServer & modbusServer, std::list<WaterClient::SlaveId> const & slaveIds)
+ClientProxy::CreateDefault(
+	GuiProxy & guiProxy, ModbusServer & modbusServer, std::list<WaterClient::SlaveId> const & slaveIds,
+	ClientProxy::Config const & config)
 {
 	DLOG("pooling " << slaveIds.size() << " slaves");
-	return std::unique_ptr<ClientProxy>(new ClientProxyImpl(guiProxy, modbusServer, slaveIds));
+	return std::unique_ptr<ClientProxy>(new ClientProxyImpl(guiProxy, modbusServer, slaveIds, config));
 }
 
 ClientProxy::~ClientProxy() = default;
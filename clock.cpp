@@ -0,0 +1,112 @@
+#include "waterServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <boost/thread/thread.hpp>
+
+namespace waterServer
+{
+
+// Monotonic, so DST changes and NTP steps neither stall the poll loop nor expire queued
+// requests. Its time points are only good for differences, not for display.
+class RealClock : public Clock
+{
+public:
+
+	virtual boost::posix_time::ptime now()
+	{
+		static boost::posix_time::ptime const origin(boost::gregorian::date(1970, 1, 1));
+		auto const sinceBoot = std::chrono::steady_clock::now().time_since_epoch();
+		return origin + boost::posix_time::microseconds(
+			std::chrono::duration_cast<std::chrono::microseconds>(sinceBoot).count());
+	}
+
+	virtual void sleepFor(boost::posix_time::time_duration const duration)
+	{
+		boost::this_thread::sleep(duration);
+	}
+
+	virtual bool sleepUntil(
+		boost::mutex::scoped_lock & lock, boost::condition & cnd, boost::posix_time::ptime const deadline)
+	{
+		return this->waitUntil(lock, cnd, deadline);
+	}
+
+	virtual bool waitUntil(
+		boost::mutex::scoped_lock & lock, boost::condition & cnd, boost::posix_time::ptime const deadline)
+	{
+		// condition may wait on wall clock, short slices keep a clock step from stretching the wait
+		while (true)
+		{
+			boost::posix_time::time_duration const left = deadline - this->now();
+			if (left <= boost::posix_time::time_duration()) return false;
+			if (cnd.timed_wait(lock, std::min(left, boost::posix_time::time_duration(boost::posix_time::seconds(1))))) return true;
+		}
+	}
+};
+
+// Time moves only when the thread driving the simulation sleeps, so runs are
+// deterministic and take no wall clock time.
+class SimulatedClock : public Clock
+{
+public:
+
+	SimulatedClock(boost::posix_time::ptime const start) : current(start) {}
+
+	virtual boost::posix_time::ptime now()
+	{
+		boost::mutex::scoped_lock lck(this->mtx);
+		return this->current;
+	}
+
+	virtual void sleepFor(boost::posix_time::time_duration const duration)
+	{
+		boost::mutex::scoped_lock lck(this->mtx);
+		this->current += duration;
+	}
+
+	virtual bool sleepUntil(
+		boost::mutex::scoped_lock & lock, boost::condition &, boost::posix_time::ptime const deadline)
+	{
+		// let threads waiting for lock in, then jump to deadline
+		lock.unlock();
+		boost::this_thread::yield();
+		lock.lock();
+
+		boost::mutex::scoped_lock lck(this->mtx);
+		if (this->current < deadline) this->current = deadline;
+		return false;
+	}
+
+	virtual bool waitUntil(
+		boost::mutex::scoped_lock & lock, boost::condition & cnd, boost::posix_time::ptime const deadline)
+	{
+		while (this->now() < deadline)
+		{
+			if (cnd.timed_wait(lock, boost::posix_time::milliseconds(1))) return true;
+		}
+		return false;
+	}
+
+private:
+
+	boost::mutex mtx;
+	boost::posix_time::ptime current;
+};
+
+Clock::~Clock() = default;
+
+Clock &
+Clock::Real()
+{
+	static RealClock realClock;
+	return realClock;
+}
+
+std::unique_ptr<Clock>
+Clock::CreateSimulated(boost::posix_time::ptime const start)
+{
+	return std::unique_ptr<Clock>(new SimulatedClock(start));
+}
+
+}
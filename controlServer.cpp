@@ -0,0 +1,236 @@
+#include "waterServer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <sstream>
+#include <limits>
+#include <boost/thread/scoped_thread.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace waterServer
+{
+
+class ControlServerImpl : public ControlServer
+{
+public:
+
+	ControlServerImpl(std::string const & socketPath, int listenFd, GuiProxy &, ClientProxy &);
+	~ControlServerImpl();
+
+private:
+
+	void workerMain();
+	void handleConnection(int fd);
+	std::string executeCommand(std::string const & line);
+
+	std::string const socketPath;
+	GuiProxy & guiProxy;
+	ClientProxy & clientProxy;
+	int listenFd;
+	boost::scoped_thread<> worker;
+};
+
+// Returns listening socket, or -1 when it can not be set up; control socket is optional,
+// so a bad path or read-only directory must not stop dispensers from being served.
+static int listenOnControlSocket(std::string const & socketPath)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(addr.sun_path))
+	{
+		ELOG("control socket path too long, running without it: " << socketPath);
+		return -1;
+	}
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+	int const listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd == -1)
+	{
+		ELOG("unable to create control socket, running without it, " << strerror(errno));
+		return -1;
+	}
+
+	// left behind by previous instance
+	::unlink(socketPath.c_str());
+
+	if (::bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1 ||
+		::listen(listenFd, 4) == -1)
+	{
+		ELOG("unable to listen on control socket " << socketPath << ", running without it, " << strerror(errno));
+		::close(listenFd);
+		return -1;
+	}
+	::chmod(socketPath.c_str(), 0660);
+	return listenFd;
+}
+
+ControlServerImpl::ControlServerImpl(
+	std::string const & socketPathArg, int const listenFdArg, GuiProxy & guiProxyArg, ClientProxy & clientProxyArg) :
+	socketPath(socketPathArg),
+	guiProxy(guiProxyArg),
+	clientProxy(clientProxyArg),
+	listenFd(listenFdArg)
+{
+	this->worker = boost::scoped_thread<>{boost::thread(&ControlServerImpl::workerMain, this)};
+	LOG("control socket listening on " << this->socketPath);
+}
+
+ControlServerImpl::~ControlServerImpl()
+{
+	this->worker.interrupt();
+	this->worker.join();
+	::close(this->listenFd);
+	::unlink(this->socketPath.c_str());
+}
+
+void
+ControlServerImpl::workerMain()
+{
+	while (true)
+	{
+		boost::this_thread::interruption_point();
+
+		struct pollfd pfd = { this->listenFd, POLLIN, 0 };
+		if (::poll(&pfd, 1, 500) <= 0) continue;
+
+		int const fd = ::accept(this->listenFd, nullptr, nullptr);
+		if (fd == -1)
+		{
+			ELOG("accepting control connection failed, " << strerror(errno));
+			continue;
+		}
+
+		this->handleConnection(fd);
+		::close(fd);
+	}
+}
+
+void
+ControlServerImpl::handleConnection(int const fd)
+{
+	// do not let an idle client block other technicians for long
+	struct timeval timeoutValue = { 30, 0 };
+	::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeoutValue, sizeof(timeoutValue));
+
+	std::string pending;
+	char buf[256];
+	while (true)
+	{
+		boost::this_thread::interruption_point();
+
+		ssize_t const len = ::recv(fd, buf, sizeof(buf), 0);
+		if (len <= 0) return;
+		pending.append(buf, len);
+
+		std::string::size_type eol;
+		while ((eol = pending.find('\n')) != std::string::npos)
+		{
+			std::string const line = pending.substr(0, eol);
+			pending.erase(0, eol + 1);
+
+			std::string const response = this->executeCommand(line);
+			if (::send(fd, response.data(), response.size(), MSG_NOSIGNAL) == -1) return;
+		}
+	}
+}
+
+std::string
+ControlServerImpl::executeCommand(std::string const & line)
+{
+	std::istringstream input(line);
+	std::string command;
+	std::string arg;
+	input >> command >> arg;
+
+	std::ostringstream osek;
+
+	if (command.empty())
+	{
+		return "";
+	}
+	else if (command == "slaves")
+	{
+		this->clientProxy.dumpSlaves(osek);
+	}
+	else if (command == "jitter")
+	{
+		if (arg == "reset") this->clientProxy.resetJitter();
+		this->clientProxy.dumpJitter(osek);
+	}
+	else if (command == "queue")
+	{
+		this->guiProxy.dumpQueue(osek);
+	}
+	else if (command == "endpoints")
+	{
+		this->guiProxy.dumpEndpoints(osek);
+	}
+	else if (command == "accounts")
+	{
+		this->guiProxy.dumpAccountIndex(osek);
+	}
+	else if (command == "negcache")
+	{
+		if (arg == "clear") this->guiProxy.clearNegativeCache();
+		this->guiProxy.dumpNegativeCache(osek);
+	}
+	else if (command == "poll" || command == "pause" || command == "resume")
+	{
+		uint32_t slaveId;
+		try
+		{
+			slaveId = boost::lexical_cast<uint32_t>(arg);
+		}
+		catch (boost::bad_lexical_cast const &)
+		{
+			return "error: " + command + " needs slave id\n";
+		}
+
+		bool const found =
+			slaveId <= std::numeric_limits<WaterClient::SlaveId>::max() &&
+			(command == "poll" ?
+				this->clientProxy.pollNow(slaveId) :
+				this->clientProxy.setPaused(slaveId, command == "pause"));
+
+		osek << (found ? "ok" : "error: unknown slave") << "\n";
+	}
+	else if (command == "help")
+	{
+		osek <<
+			"slaves          list slaves and their state\n"
+			"poll <slave>    poll slave now, skipping round-robin wait\n"
+			"pause <slave>   stop polling slave\n"
+			"resume <slave>  resume polling slave\n"
+			"jitter [reset]  show or reset poll thread wake up lateness histogram\n"
+			"queue           dump requests waiting for GUI\n"
+			"endpoints       show GUI endpoints latency and errors\n"
+			"negcache [clear] show or clear cache of ids not found in GUI\n"
+			"accounts        show local account index state\n";
+	}
+	else
+	{
+		osek << "error: unknown command " << command << ", try help\n";
+	}
+
+	LOG("control command: " << line);
+	return osek.str();
+}
+
+ControlServer::~ControlServer() = default;
+
+std::unique_ptr<ControlServer>
+ControlServer::CreateDefault(std::string const & socketPath, GuiProxy & guiProxy, ClientProxy & clientProxy)
+{
+	int const listenFd = listenOnControlSocket(socketPath);
+	if (listenFd == -1) return std::unique_ptr<ControlServer>();
+	return std::unique_ptr<ControlServer>(new ControlServerImpl(socketPath, listenFd, guiProxy, clientProxy));
+}
+
+}
@@ -0,0 +1,209 @@
+#include "waterServer.h"
+
+#include <sstream>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/foreach.hpp>
+
+namespace waterServer
+{
+
+namespace pt = boost::property_tree;
+
+namespace
+{
+
+uint8_t const FORMAT_VERSION = 1;
+
+size_t const REQUEST_SIZE = 1 + 1 + 8 + 8 + 4;
+size_t const CREDIT_SIZE = 1 + 4;
+size_t const ACCOUNTS_HEADER_SIZE = 1 + 8 + 4;
+size_t const ACCOUNT_SIZE = 8 + 8 + 8 + 4 + 1;
+
+enum AccountFlags : uint8_t { HAS_RFID = 1, DELETED = 2 };
+
+class Writer
+{
+public:
+
+	Writer(size_t size) { this->out.reserve(size); }
+
+	template <class T> void put(T const value)
+	{
+		uint64_t const bits = static_cast<uint64_t>(value);
+		for (size_t i = 0; i < sizeof(T); ++i) this->out.push_back(static_cast<char>(bits >> (8 * i)));
+	}
+
+	std::string out;
+};
+
+class Reader
+{
+public:
+
+	Reader(std::string const & inArg) : in(inArg), pos(0) {}
+
+	template <class T> bool get(T & value)
+	{
+		if (this->in.size() - this->pos < sizeof(T)) return false;
+		uint64_t bits = 0;
+		for (size_t i = 0; i < sizeof(T); ++i) bits |= uint64_t(static_cast<uint8_t>(this->in[this->pos++])) << (8 * i);
+		value = static_cast<T>(bits);
+		return true;
+	}
+
+	bool atEnd() const { return this->pos == this->in.size(); }
+
+private:
+
+	std::string const & in;
+	size_t pos;
+};
+
+bool readFormat(Reader & reader)
+{
+	uint8_t format = 0;
+	return reader.get(format) && format == FORMAT_VERSION;
+}
+
+}
+
+char const GuiCodec::BINARY_CONTENT_TYPE[] = "application/vnd.water.v1";
+
+std::string
+GuiCodec::EncodeRequest(Request const & request)
+{
+	Writer writer(REQUEST_SIZE);
+	writer.put(FORMAT_VERSION);
+	writer.put(static_cast<uint8_t>(request.kind));
+	writer.put(request.id);
+	writer.put(request.pin);
+	writer.put(static_cast<int32_t>(request.consumedCredit));
+	return writer.out;
+}
+
+bool
+GuiCodec::DecodeRequest(std::string const & body, Request & request)
+{
+	Reader reader(body);
+	uint8_t kind;
+	int32_t consumedCredit;
+	if (!readFormat(reader) || !reader.get(kind) || !reader.get(request.id) || !reader.get(request.pin) ||
+		!reader.get(consumedCredit) || !reader.atEnd())
+	{
+		return false;
+	}
+	if (kind < static_cast<uint8_t>(RequestKind::ID_PIN) || kind > static_cast<uint8_t>(RequestKind::ACCOUNTS)) return false;
+
+	request.kind = static_cast<RequestKind>(kind);
+	request.consumedCredit = consumedCredit;
+	return true;
+}
+
+std::string
+GuiCodec::EncodeCredit(WaterClient::Credit const credit)
+{
+	Writer writer(CREDIT_SIZE);
+	writer.put(FORMAT_VERSION);
+	writer.put(static_cast<int32_t>(credit));
+	return writer.out;
+}
+
+std::string
+GuiCodec::EncodeAccounts(uint64_t const version, std::list<Account> const & accounts)
+{
+	Writer writer(ACCOUNTS_HEADER_SIZE + ACCOUNT_SIZE * accounts.size());
+	writer.put(FORMAT_VERSION);
+	writer.put(version);
+	writer.put(static_cast<uint32_t>(accounts.size()));
+	BOOST_FOREACH(Account const & account, accounts)
+	{
+		writer.put(static_cast<uint64_t>(account.userId));
+		writer.put(static_cast<uint64_t>(account.pin));
+		writer.put(static_cast<uint64_t>(account.rfidId ? *account.rfidId : 0));
+		writer.put(static_cast<int32_t>(account.credit));
+		writer.put(static_cast<uint8_t>((account.rfidId ? HAS_RFID : 0) | (account.deleted ? DELETED : 0)));
+	}
+	return writer.out;
+}
+
+bool
+GuiCodec::DecodeCredit(std::string const & body, bool const binary, WaterClient::Credit & credit)
+{
+	if (binary)
+	{
+		Reader reader(body);
+		int32_t value;
+		if (!readFormat(reader) || !reader.get(value) || !reader.atEnd()) return false;
+		credit = value;
+		return true;
+	}
+
+	try
+	{
+		pt::ptree responseRoot;
+		std::stringstream ss(body);
+		boost::property_tree::read_json(ss, responseRoot);
+		credit = responseRoot.get<int32_t>("credit");
+		return true;
+	}
+	catch (pt::ptree_error const & parseError)
+	{
+		ELOG("could not parse credit answer, " << parseError.what());
+		return false;
+	}
+}
+
+bool
+GuiCodec::DecodeAccounts(std::string const & body, bool const binary, uint64_t & version, std::list<Account> & accounts)
+{
+	if (binary)
+	{
+		Reader reader(body);
+		uint32_t count;
+		if (!readFormat(reader) || !reader.get(version) || !reader.get(count)) return false;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint64_t userId, pin, rfidId;
+			int32_t credit;
+			uint8_t flags;
+			if (!reader.get(userId) || !reader.get(pin) || !reader.get(rfidId) || !reader.get(credit) || !reader.get(flags))
+			{
+				return false;
+			}
+			accounts.push_back(Account{
+				static_cast<WaterClient::UserId>(userId),
+				static_cast<WaterClient::Pin>(pin),
+				(flags & HAS_RFID) ? boost::make_optional(static_cast<WaterClient::RfidId>(rfidId)) : boost::none,
+				credit,
+				(flags & DELETED) != 0});
+		}
+		return reader.atEnd();
+	}
+
+	try
+	{
+		pt::ptree responseRoot;
+		std::stringstream ss(body);
+		boost::property_tree::read_json(ss, responseRoot);
+
+		version = responseRoot.get<uint64_t>("version");
+		BOOST_FOREACH(pt::ptree::value_type const & user, responseRoot.get_child("users"))
+		{
+			accounts.push_back(Account{
+				user.second.get<WaterClient::UserId>("client_id"),
+				user.second.get<WaterClient::Pin>("pin", 0),
+				user.second.get_optional<WaterClient::RfidId>("client_rfid"),
+				user.second.get<WaterClient::Credit>("credit", 0),
+				user.second.get<bool>("deleted", false)});
+		}
+		return true;
+	}
+	catch (pt::ptree_error const & parseError)
+	{
+		ELOG("could not parse accounts answer, " << parseError.what());
+		return false;
+	}
+}
+
+}
@@ -2,65 +2,642 @@
 
 #include <boost/thread/scoped_thread.hpp>
 #include <boost/thread/condition.hpp>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/foreach.hpp>
+#include <boost/optional.hpp>
+#include <boost/circular_buffer.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+#include <vector>
 #include <curl/curl.h>
 
 namespace waterServer
 {
 
-namespace pt = boost::property_tree;
+struct AccountKey
+{
+	enum class Type : uint8_t { ID_PIN, RFID };
+
+	Type type;
+	uint64_t id;
+	uint64_t pin;
+
+	bool operator==(AccountKey const & other) const
+	{
+		return this->type == other.type && this->id == other.id && this->pin == other.pin;
+	}
+};
+
+struct AccountKeyHash
+{
+	size_t operator()(AccountKey const & key) const
+	{
+		uint64_t h = key.id * 0x9E3779B97F4A7C15ULL;
+		h ^= (key.pin + static_cast<uint64_t>(key.type)) * 0xC2B2AE3D27D4EB4FULL;
+		return static_cast<size_t>(h ^ (h >> 29));
+	}
+};
+
+// Remembers ids GUI recently answered with 404, so stray cards do not cost a round trip every scan.
+class NegativeCache
+{
+public:
+
+	NegativeCache(size_t capacityArg, boost::posix_time::time_duration ttlArg) :
+		capacity(capacityArg), ttl(ttlArg), hits(0), misses(0)
+	{}
+
+	bool contains(AccountKey const &, boost::posix_time::ptime now);
+	void insert(AccountKey const &, boost::posix_time::ptime now);
+	void erase(AccountKey const & key) { this->expiries.erase(key); }
+	void clear();
+	void dump(std::ostream &) const;
+
+private:
+
+	size_t const capacity;
+	boost::posix_time::time_duration const ttl;
+
+	std::unordered_map<AccountKey, boost::posix_time::ptime, AccountKeyHash> expiries;
+	std::deque<std::pair<AccountKey, boost::posix_time::ptime>> insertionOrder; // for evicting oldest
+
+	unsigned long hits;
+	unsigned long misses;
+};
+
+bool
+NegativeCache::contains(AccountKey const & key, boost::posix_time::ptime const now)
+{
+	auto const it = this->expiries.find(key);
+	if (it != this->expiries.end() && it->second > now)
+	{
+		++this->hits;
+		return true;
+	}
+	++this->misses;
+	return false;
+}
+
+void
+NegativeCache::insert(AccountKey const & key, boost::posix_time::ptime const now)
+{
+	if (this->capacity == 0) return;
+
+	while (!this->insertionOrder.empty() &&
+		(this->expiries.size() >= this->capacity ||
+		 this->insertionOrder.size() >= 2 * this->capacity ||
+		 this->insertionOrder.front().second <= now))
+	{
+		auto const & oldest = this->insertionOrder.front();
+		auto const it = this->expiries.find(oldest.first);
+		// entry could have been refreshed or erased since
+		if (it != this->expiries.end() && it->second == oldest.second) this->expiries.erase(it);
+		this->insertionOrder.pop_front();
+	}
+
+	auto const expiry = now + this->ttl;
+	this->expiries[key] = expiry;
+	this->insertionOrder.push_back(std::make_pair(key, expiry));
+}
+
+void
+NegativeCache::clear()
+{
+	this->expiries.clear();
+	this->insertionOrder.clear();
+}
+
+void
+NegativeCache::dump(std::ostream & osek) const
+{
+	osek << "negativeCache size:" << this->expiries.size() << "/" << this->capacity
+		<< " ttlSec:" << this->ttl.total_seconds()
+		<< " hits:" << this->hits << " misses:" << this->misses << "\n";
+}
+
+// Local replica of GUI accounts, answers logins without a round trip.
+// GUI stays authoritative: accounts are answered locally only when local credit covers
+// the consumption, every local consumption is reported to GUI in background and GUI's
+// credit from that report (less consumptions still in flight) overwrites the local one.
+class AccountIndex
+{
+public:
+
+	struct Account
+	{
+		WaterClient::UserId userId;
+		WaterClient::Pin pin;
+		boost::optional<WaterClient::RfidId> rfidId;
+		WaterClient::Credit credit;
+		WaterClient::Credit pendingConsumption; // consumed locally, not yet confirmed by GUI
+	};
+
+	AccountIndex() : version(0), loaded(false), localAnswers(0), conflicts(0) {}
+
+	bool consumeLocally(AccountKey const &, WaterClient::Credit creditToConsume, WaterClient::Credit & creditAvail);
+	void reconcile(AccountKey const &, WaterClient::Credit consumed, WaterClient::Credit guiCredit);
+	void updateCredit(AccountKey const &, WaterClient::Credit guiCredit);
+	void update(Account const & fromGui);
+	void remove(WaterClient::UserId);
+	void remove(AccountKey const &);
+	void dump(std::ostream &) const;
+
+	uint64_t version; // of GUI accounts data, deltas are requested since it
+	bool loaded;
+
+private:
+
+	Account * find(AccountKey const &);
+
+	std::unordered_map<WaterClient::UserId, Account> accounts;
+	std::unordered_map<WaterClient::RfidId, WaterClient::UserId> userIdByRfid;
+
+	unsigned long localAnswers;
+	unsigned long conflicts;
+};
+
+AccountIndex::Account *
+AccountIndex::find(AccountKey const & key)
+{
+	if (key.type == AccountKey::Type::RFID)
+	{
+		auto const rfidIt = this->userIdByRfid.find(key.id);
+		if (rfidIt == this->userIdByRfid.end()) return nullptr;
+		auto const it = this->accounts.find(rfidIt->second);
+		return it == this->accounts.end() ? nullptr : &it->second;
+	}
+
+	auto const it = this->accounts.find(key.id);
+	if (it == this->accounts.end() || it->second.pin != key.pin) return nullptr;
+	return &it->second;
+}
+
+bool
+AccountIndex::consumeLocally(
+	AccountKey const & key, WaterClient::Credit const creditToConsume, WaterClient::Credit & creditAvail)
+{
+	Account * const account = this->find(key);
+	if (account == nullptr || account->credit < creditToConsume) return false;
+
+	account->credit -= creditToConsume;
+	account->pendingConsumption += creditToConsume;
+	creditAvail = account->credit;
+	++this->localAnswers;
+	return true;
+}
+
+void
+AccountIndex::reconcile(AccountKey const & key, WaterClient::Credit const consumed, WaterClient::Credit const guiCredit)
+{
+	Account * const account = this->find(key);
+	if (account == nullptr) return;
+
+	account->pendingConsumption = std::max<WaterClient::Credit>(0, account->pendingConsumption - consumed);
+	WaterClient::Credit const expectedGuiCredit = account->credit + account->pendingConsumption;
+	if (expectedGuiCredit != guiCredit)
+	{
+		++this->conflicts;
+		WLOG("credit conflict for user " << account->userId << ", local:" << expectedGuiCredit
+			<< ", gui:" << guiCredit << ", taking gui value");
+	}
+	account->credit = guiCredit - account->pendingConsumption;
+}
+
+void
+AccountIndex::updateCredit(AccountKey const & key, WaterClient::Credit const guiCredit)
+{
+	Account * const account = this->find(key);
+	if (account != nullptr) account->credit = guiCredit - account->pendingConsumption;
+}
+
+void
+AccountIndex::update(Account const & fromGui)
+{
+	auto const it = this->accounts.find(fromGui.userId);
+	WaterClient::Credit const pending = it == this->accounts.end() ? 0 : it->second.pendingConsumption;
+	if (it != this->accounts.end() && it->second.rfidId) this->userIdByRfid.erase(*it->second.rfidId);
+
+	Account & account = this->accounts[fromGui.userId];
+	account = fromGui;
+	account.pendingConsumption = pending;
+	account.credit = fromGui.credit - pending;
+	if (account.rfidId) this->userIdByRfid[*account.rfidId] = account.userId;
+}
+
+void
+AccountIndex::remove(WaterClient::UserId const userId)
+{
+	auto const it = this->accounts.find(userId);
+	if (it == this->accounts.end()) return;
+	if (it->second.rfidId) this->userIdByRfid.erase(*it->second.rfidId);
+	this->accounts.erase(it);
+}
+
+void
+AccountIndex::remove(AccountKey const & key)
+{
+	Account const * const account = this->find(key);
+	if (account != nullptr) this->remove(account->userId);
+}
+
+void
+AccountIndex::dump(std::ostream & osek) const
+{
+	osek << "accountIndex loaded:" << this->loaded
+		<< " version:" << this->version
+		<< " accounts:" << this->accounts.size()
+		<< " localAnswers:" << this->localAnswers
+		<< " conflicts:" << this->conflicts << "\n";
+}
 
 struct GuiRequest
 {
-	std::string path;
+	std::string name;
 	std::string postParams;
-	pt::ptree responseRoot;
+	std::string binaryBody; // same request for endpoints speaking GuiCodec
+	bool idempotent; // does not consume credit, so it is safe to send it to two endpoints
+	boost::posix_time::ptime queuedAt;
+	AccountKey accountKey;
+	WaterClient::Credit creditToConsume;
 
-	GuiProxy::Callback* callback;
+	GuiProxy::Callback* callback; // nullptr for background reports of locally answered consumption
+	RequestTrace * trace;
 };
 
 std::ostream & operator<<(std::ostream & osek, GuiRequest const & rq)
 {
-	osek << "{url:" << rq.path << ",params:" << rq.postParams << "}";
+	osek << "{name:" << rq.name << ",params:" << rq.postParams << "}";
 	return osek;
 }
 
+// Requests waiting for GUI. Login lookups are served before consumption reports and
+// within each class slaves take turns, so one busy slave or a backlog of reports after
+// an outage does not delay logins at other dispensers. Every request costs the same,
+// so deficit round robin reduces to plain round robin over slaves with queued requests.
+class GuiRequestQueue
+{
+public:
+
+	GuiRequestQueue() : interactiveInRow(0) {}
+
+	void push(GuiRequest const &);
+	GuiRequest pop();
+
+	// removes longest waiting request of a slave, reports of local consumption are never dropped
+	bool dropOldest(GuiRequest & dropped);
+
+	bool empty() const { return this->size() == 0; }
+	size_t size() const { return this->tiers[INTERACTIVE].size + this->tiers[BACKGROUND].size; }
+
+	// requests some slave waits for, reports of local consumption are not counted
+	size_t slaveRequests() const;
+
+	void dump(std::ostream &, boost::posix_time::ptime now) const;
+
+private:
+
+	enum Priority { INTERACTIVE = 0, BACKGROUND = 1, PRIORITIES };
+
+	// background is served at least once per that many interactive requests
+	static constexpr unsigned MAX_INTERACTIVE_IN_ROW = 4;
+
+	struct Tier
+	{
+		Tier() : size(0) {}
+
+		std::unordered_map<GuiProxy::Callback*, std::list<GuiRequest>> flows;
+		std::list<GuiProxy::Callback*> rotation; // slaves having requests, next to serve first
+		size_t size;
+
+		GuiRequest pop();
+		GuiRequest remove(GuiProxy::Callback * key);
+	};
+
+	static Priority priorityOf(GuiRequest const & request)
+	{
+		return request.callback != nullptr && request.creditToConsume == 0 ? INTERACTIVE : BACKGROUND;
+	}
+
+	Tier tiers[PRIORITIES];
+	unsigned interactiveInRow;
+};
+
+void
+GuiRequestQueue::push(GuiRequest const & request)
+{
+	Tier & tier = this->tiers[priorityOf(request)];
+	std::list<GuiRequest> & flow = tier.flows[request.callback];
+	if (flow.empty()) tier.rotation.push_back(request.callback);
+	flow.push_back(request);
+	++tier.size;
+}
+
+size_t
+GuiRequestQueue::slaveRequests() const
+{
+	auto const reports = this->tiers[BACKGROUND].flows.find(nullptr);
+	return this->size() - (reports == this->tiers[BACKGROUND].flows.end() ? 0 : reports->second.size());
+}
+
+GuiRequest
+GuiRequestQueue::pop()
+{
+	BOOST_ASSERT_MSG(!this->empty(), "pop from empty queue");
+
+	bool const takeBackground = this->tiers[INTERACTIVE].size == 0 ||
+		(this->tiers[BACKGROUND].size > 0 && this->interactiveInRow >= MAX_INTERACTIVE_IN_ROW);
+
+	if (takeBackground)
+	{
+		this->interactiveInRow = 0;
+		return this->tiers[BACKGROUND].pop();
+	}
+
+	++this->interactiveInRow;
+	return this->tiers[INTERACTIVE].pop();
+}
+
+bool
+GuiRequestQueue::dropOldest(GuiRequest & dropped)
+{
+	Tier * oldestTier = nullptr;
+	GuiProxy::Callback * oldestKey = nullptr;
+	boost::posix_time::ptime oldestQueuedAt(boost::posix_time::pos_infin);
+
+	BOOST_FOREACH(Tier & tier, this->tiers)
+	{
+		BOOST_FOREACH(GuiProxy::Callback * const key, tier.rotation)
+		{
+			if (key == nullptr) continue;
+			GuiRequest const & head = tier.flows.at(key).front();
+			if (head.queuedAt < oldestQueuedAt)
+			{
+				oldestTier = &tier;
+				oldestKey = key;
+				oldestQueuedAt = head.queuedAt;
+			}
+		}
+	}
+
+	if (oldestTier == nullptr) return false;
+	dropped = oldestTier->remove(oldestKey);
+	return true;
+}
+
+GuiRequest
+GuiRequestQueue::Tier::pop()
+{
+	GuiProxy::Callback * const key = this->rotation.front();
+	this->rotation.pop_front();
+
+	auto const flow = this->flows.find(key);
+	GuiRequest const request = flow->second.front();
+	flow->second.pop_front();
+
+	if (flow->second.empty()) this->flows.erase(flow);
+	else this->rotation.push_back(key);
+
+	--this->size;
+	return request;
+}
+
+GuiRequest
+GuiRequestQueue::Tier::remove(GuiProxy::Callback * const key)
+{
+	auto const flow = this->flows.find(key);
+	GuiRequest const request = flow->second.front();
+	flow->second.pop_front();
+
+	// slave keeps its turn in rotation while it has requests left
+	if (flow->second.empty())
+	{
+		this->flows.erase(flow);
+		this->rotation.remove(key);
+	}
+
+	--this->size;
+	return request;
+}
+
+void
+GuiRequestQueue::dump(std::ostream & osek, boost::posix_time::ptime const now) const
+{
+	char const * const names[PRIORITIES] = { "interactive", "background" };
+	for (int priority = INTERACTIVE; priority < PRIORITIES; ++priority)
+	{
+		Tier const & tier = this->tiers[priority];
+		osek << names[priority] << " requests:" << tier.size << " slaves:" << tier.flows.size() << "\n";
+		BOOST_FOREACH(GuiProxy::Callback * const key, tier.rotation)
+		{
+			BOOST_FOREACH(GuiRequest const & request, tier.flows.at(key))
+			{
+				osek << request << " waiting:" << (now - request.queuedAt).total_milliseconds() << "ms\n";
+			}
+		}
+	}
+}
+
+struct GuiResponse
+{
+	CURLcode curlCode;
+	long httpCode;
+	std::string body;
+	bool binary; // body is GuiCodec encoded, JSON otherwise
+	long requestBytes; // sent to GUI, 0 when connection was never made
+};
+
+class GuiEndpoint
+{
+public:
+
+	GuiEndpoint(std::string const & urlArg) :
+		url(urlArg), binary(false), rttEwmaMs(0), errorRate(0), requests(0), failures(0), recentRttMs(32)
+	{}
+
+	std::string const url;
+	bool binary; // answered with GuiCodec, so requests are sent that way too
+
+	void recordSuccess(boost::posix_time::time_duration rtt, boost::posix_time::ptime now);
+	void recordFailure(boost::posix_time::ptime now);
+
+	// lower is better, endpoints without samples come first so each one gets measured
+	double score(boost::posix_time::ptime const now) const
+	{
+		double const errors = this->errorRateAt(now);
+		return this->rttEwmaMs * (1.0 + 10.0 * errors) + 1000.0 * errors;
+	}
+
+	// p95 of recent round trips, none until there are enough samples
+	boost::optional<boost::posix_time::time_duration> hedgeDelay() const;
+
+	void dump(std::ostream &, boost::posix_time::ptime now) const;
+
+private:
+
+	static constexpr double ALPHA = 0.2;
+	static constexpr double ERROR_HALF_LIFE_SEC = 30; // failed endpoint is tried again once its errors fade
+
+	// error rate decays with time too, an endpoint that failed and is never picked again would keep it forever
+	double errorRateAt(boost::posix_time::ptime now) const;
+
+	double rttEwmaMs;
+	double errorRate;
+	boost::posix_time::ptime errorRateUpdatedAt;
+	unsigned requests;
+	unsigned failures;
+	boost::circular_buffer<long> recentRttMs;
+};
+
+double
+GuiEndpoint::errorRateAt(boost::posix_time::ptime const now) const
+{
+	if (this->errorRateUpdatedAt.is_not_a_date_time() || now <= this->errorRateUpdatedAt) return this->errorRate;
+
+	double const elapsedSec = (now - this->errorRateUpdatedAt).total_milliseconds() / 1000.0;
+	return this->errorRate * std::pow(0.5, elapsedSec / ERROR_HALF_LIFE_SEC);
+}
+
+void
+GuiEndpoint::recordSuccess(boost::posix_time::time_duration const rtt, boost::posix_time::ptime const now)
+{
+	long const rttMs = rtt.total_milliseconds();
+	this->rttEwmaMs = this->requests == 0 ? rttMs : (1 - ALPHA) * this->rttEwmaMs + ALPHA * rttMs;
+	this->errorRate = (1 - ALPHA) * this->errorRateAt(now);
+	this->errorRateUpdatedAt = now;
+	this->recentRttMs.push_back(rttMs);
+	++this->requests;
+}
+
+void
+GuiEndpoint::recordFailure(boost::posix_time::ptime const now)
+{
+	this->errorRate = (1 - ALPHA) * this->errorRateAt(now) + ALPHA;
+	this->errorRateUpdatedAt = now;
+	++this->requests;
+	++this->failures;
+}
+
+boost::optional<boost::posix_time::time_duration>
+GuiEndpoint::hedgeDelay() const
+{
+	if (this->recentRttMs.size() < 8) return boost::none;
+
+	std::vector<long> sorted(this->recentRttMs.begin(), this->recentRttMs.end());
+	auto const p95 = sorted.begin() + (sorted.size() * 95) / 100;
+	std::nth_element(sorted.begin(), p95, sorted.end());
+	return boost::posix_time::milliseconds(*p95);
+}
+
+void
+GuiEndpoint::dump(std::ostream & osek, boost::posix_time::ptime const now) const
+{
+	osek << "endpoint:" << this->url
+		<< " rttEwmaMs:" << static_cast<long>(this->rttEwmaMs)
+		<< " errorRate:" << this->errorRateAt(now)
+		<< " requests:" << this->requests
+		<< " failures:" << this->failures
+		<< " format:" << (this->binary ? "binary" : "json");
+
+	auto const p95 = this->hedgeDelay();
+	if (p95) osek << " p95Ms:" << p95->total_milliseconds();
+	osek << "\n";
+}
+
+struct GuiTransfer
+{
+	GuiTransfer(GuiEndpoint & endpointArg) :
+		endpoint(endpointArg),
+		curl(curl_easy_init(), curl_easy_cleanup),
+		headers(nullptr, curl_slist_free_all),
+		binaryRequest(false),
+		startedAt(Clock::Real().now())
+	{
+		BOOST_ASSERT_MSG(this->curl.get() != nullptr, "curl initialization failed");
+	}
+
+	GuiEndpoint & endpoint;
+	std::unique_ptr<CURL, void(*)(CURL*)> curl;
+	std::unique_ptr<curl_slist, void(*)(curl_slist*)> headers;
+	bool binaryRequest;
+	std::string url;
+	std::string body;
+	boost::posix_time::ptime startedAt;
+};
+
 class GuiProxyImpl : public GuiProxy
 {
 
 	virtual void handleIdPinRequest(WaterClient::UserId userId, WaterClient::Pin pin, WaterClient::Credit creditToConsume, GuiProxy::Callback*);
 	virtual void handleRfidRequest(WaterClient::RfidId rfidId, WaterClient::Credit creditToConsume, GuiProxy::Callback*);
+	virtual void dumpQueue(std::ostream &);
+	virtual void dumpEndpoints(std::ostream &);
+	virtual void dumpNegativeCache(std::ostream &);
+	virtual void clearNegativeCache();
+	virtual void dumpAccountIndex(std::ostream &);
+	virtual bool isOverloaded();
 
 	void handleRequestImpl(
-		std::string urlRequestName, std::string urlRequestParams,
+		std::string urlRequestName, std::string urlRequestParams, AccountKey const & accountKey,
 		WaterClient::Credit creditToConsume, GuiProxy::Callback* callback);
 
 public:
 
-	GuiProxyImpl(std::string const & guiUrl);
+	GuiProxyImpl(GuiProxy::Config const &);
 	~GuiProxyImpl();
 
 private:
 
 	void workerMain();
+	GuiResponse sendRequest(GuiRequest const &);
+	void startTransfer(CURLM *, std::list<GuiTransfer> &, GuiEndpoint &, GuiRequest const &);
+	void deliverResponse(GuiRequest const &, GuiResponse const &);
+	void deliverReconciliation(GuiRequest const &, GuiResponse const &);
+	bool syncDue() const;
+	void updateOverloaded();
+	void syncAccounts();
+	std::vector<GuiEndpoint*> endpointsByScore();
 
-	std::string const urlPrefix;
-	boost::scoped_thread<> worker;
-	
-	std::list<GuiRequest> requests;
+	std::list<GuiEndpoint> endpoints;
+	bool const hedgeRequests;
+	long const timeoutMs;
+	boost::mutex statsMtx; // guards endpoints stats, read by control requests
+	Clock & clock; // HTTP round trips are real, they are measured on Clock::Real()
+
+	NegativeCache negativeCache;
+	boost::mutex negativeCacheMtx;
+
+	bool const accountIndexEnabled;
+	boost::posix_time::time_duration const accountSyncInterval;
+	boost::posix_time::ptime nextAccountSync; // used by worker only
+	AccountIndex accountIndex;
+	std::list<GuiRequest> failedReconciliations; // never reached GUI, requeued on next sync
+	boost::mutex accountIndexMtx;
+
+	static constexpr size_t MAX_FAILED_RECONCILIATIONS = 1024;
+
+	GuiRequestQueue requests;
+	size_t const queueCapacity;
+	boost::posix_time::time_duration const maxQueueWait;
+	std::atomic<bool> overloaded; // set at high watermark, cleared at low one, read on every slave poll
+	unsigned long shedRequests;
+	unsigned long expiredRequests;
 	boost::mutex mtx;
 	boost::condition cnd;
 
+	boost::scoped_thread<> worker;
 };
 
 GuiProxy::Callback::~Callback() = default;
 
 std::unique_ptr<GuiProxy>
-GuiProxy::CreateDefault(std::string const & guiUrl)
+GuiProxy::CreateDefault(GuiProxy::Config const & config)
 {
-	return std::unique_ptr<GuiProxy>(new GuiProxyImpl(guiUrl));
+	return std::unique_ptr<GuiProxy>(new GuiProxyImpl(config));
 }
 
 void
@@ -81,6 +658,7 @@ GuiProxyImpl::handleIdPinRequest(WaterClient::UserId userId, WaterClient::Pin pi
 	this->handleRequestImpl(
 		"getuser_idpin",
 		std::string("client_id=") + boost::lexical_cast<std::string>(userId) + "&pin=" + boost::lexical_cast<std::string>(pin),
+		AccountKey{AccountKey::Type::ID_PIN, userId, pin},
 		creditToConsume,
 		callback);
 }
@@ -90,30 +668,167 @@ void GuiProxyImpl::handleRfidRequest(WaterClient::RfidId rfidId, WaterClient::Cr
 	this->handleRequestImpl(
 		"getuser_rfid",
 		std::string("client_rfid=") + boost::lexical_cast<std::string>(rfidId),
+		AccountKey{AccountKey::Type::RFID, rfidId, 0},
 		creditToConsume,
 		callback);
 }
 
 void
 GuiProxyImpl::handleRequestImpl(
-	std::string urlRequestName, std::string urlRequestParams, WaterClient::Credit creditToConsume, GuiProxy::Callback* callback)
+	std::string urlRequestName, std::string urlRequestParams, AccountKey const & accountKey,
+	WaterClient::Credit creditToConsume, GuiProxy::Callback* callback)
 {
+	auto const now = this->clock.now();
+
+	bool knownAsNotFound;
+	{
+		boost::mutex::scoped_lock lck(this->negativeCacheMtx);
+		knownAsNotFound = this->negativeCache.contains(accountKey, now);
+	}
+	if (knownAsNotFound)
+	{
+		LOG("not found (cached), " << urlRequestName << " " << urlRequestParams);
+		callback->notFound();
+		return;
+	}
+
 	if (creditToConsume > 0) urlRequestParams += "&consumed_credit=" + boost::lexical_cast<std::string>(creditToConsume);
 
+	bool answeredLocally = false;
+	WaterClient::Credit creditAvail = 0;
+	if (this->accountIndexEnabled)
+	{
+		boost::mutex::scoped_lock lck(this->accountIndexMtx);
+		answeredLocally = this->accountIndex.consumeLocally(accountKey, creditToConsume, creditAvail);
+	}
+
+	if (answeredLocally)
+	{
+		LOG("success (local), " << urlRequestName << " " << urlRequestParams << ", creditsAvail:" << creditAvail);
+		callback->success(creditAvail);
+		if (creditToConsume == 0) return;
+		// GUI still has to learn about the consumption
+		callback = nullptr;
+	}
+
+	RequestTrace * const trace = callback != nullptr ? callback->trace() : nullptr;
+	if (trace != nullptr) trace->stamp(RequestTrace::GUI_QUEUED);
+
+	bool shed = false;
+	GuiRequest shedRequest;
 	{
 		boost::mutex::scoped_lock lck(this->mtx);
-		this->requests.push_back(GuiRequest{this->urlPrefix + "/" + urlRequestName, urlRequestParams, {}, callback});
+		if (callback != nullptr && this->requests.slaveRequests() >= this->queueCapacity)
+		{
+			shed = this->requests.dropOldest(shedRequest);
+			if (shed) ++this->shedRequests;
+		}
+		this->requests.push(GuiRequest{
+			urlRequestName, urlRequestParams, GuiCodec::EncodeRequest(GuiCodec::Request{
+				accountKey.type == AccountKey::Type::RFID ? GuiCodec::RequestKind::RFID : GuiCodec::RequestKind::ID_PIN,
+				accountKey.id, accountKey.pin, creditToConsume}),
+			creditToConsume == 0, now, accountKey, creditToConsume, callback, trace});
+		this->updateOverloaded();
 	}
 	this->cnd.notify_one();
+
+	if (shed)
+	{
+		WLOG("queue full, shedding request: " << shedRequest);
+		shedRequest.callback->timeout();
+	}
+}
+
+void
+GuiProxyImpl::updateOverloaded()
+{
+	// hysteresis, so slaves are not throttled and released on every request; reports of local
+	// consumption are left out, a backlog of them must not stop slaves from being read
+	size_t const highWatermark = std::max<size_t>(this->queueCapacity * 3 / 4, 1);
+	size_t const lowWatermark = std::min(this->queueCapacity / 2, highWatermark - 1);
+	size_t const size = this->requests.slaveRequests();
+	if (size >= highWatermark) this->overloaded = true;
+	else if (size <= lowWatermark) this->overloaded = false;
+}
+
+bool
+GuiProxyImpl::isOverloaded()
+{
+	return this->overloaded;
+}
+
+void
+GuiProxyImpl::dumpQueue(std::ostream & osek)
+{
+	auto const now = this->clock.now();
+
+	boost::mutex::scoped_lock lck(this->mtx);
+	osek << "queued requests:" << this->requests.size()
+		<< " fromSlaves:" << this->requests.slaveRequests()
+		<< " capacity:" << this->queueCapacity
+		<< " overloaded:" << this->overloaded
+		<< " shed:" << this->shedRequests
+		<< " expired:" << this->expiredRequests << "\n";
+	this->requests.dump(osek, now);
+}
+
+void
+GuiProxyImpl::dumpEndpoints(std::ostream & osek)
+{
+	boost::posix_time::ptime const now = Clock::Real().now();
+
+	boost::mutex::scoped_lock lck(this->statsMtx);
+	BOOST_FOREACH(GuiEndpoint const & endpoint, this->endpoints)
+	{
+		endpoint.dump(osek, now);
+	}
+}
+
+void
+GuiProxyImpl::dumpNegativeCache(std::ostream & osek)
+{
+	boost::mutex::scoped_lock lck(this->negativeCacheMtx);
+	this->negativeCache.dump(osek);
 }
 
+void
+GuiProxyImpl::dumpAccountIndex(std::ostream & osek)
+{
+	boost::mutex::scoped_lock lck(this->accountIndexMtx);
+	this->accountIndex.dump(osek);
+	osek << "failed reconciliations waiting for retry:" << this->failedReconciliations.size() << "\n";
+}
+
+void
+GuiProxyImpl::clearNegativeCache()
+{
+	LOG("clearing negative cache");
+	boost::mutex::scoped_lock lck(this->negativeCacheMtx);
+	this->negativeCache.clear();
+}
 
 
-GuiProxyImpl::GuiProxyImpl(std::string const & urlPrefixArg) :
-	urlPrefix(urlPrefixArg),
+GuiProxyImpl::GuiProxyImpl(GuiProxy::Config const & config) :
+	endpoints(config.urls.begin(), config.urls.end()),
+	hedgeRequests(config.hedgeRequests),
+	timeoutMs(config.timeoutSec * 1000L),
+	clock(config.clock != nullptr ? *config.clock : Clock::Real()),
+	negativeCache(config.negativeCacheSize, boost::posix_time::seconds(config.negativeCacheTtlSec)),
+	accountIndexEnabled(config.accountIndex),
+	accountSyncInterval(boost::posix_time::seconds(config.accountSyncIntervalSec)),
+	nextAccountSync(this->clock.now()), // bulk load at start
+	queueCapacity(std::max<size_t>(config.queueCapacity, 1)),
+	maxQueueWait(boost::posix_time::seconds(config.maxQueueWaitSec)),
+	overloaded(false),
+	shedRequests(0),
+	expiredRequests(0),
 	worker{boost::thread(&GuiProxyImpl::workerMain, this)}
 {
-	DLOG("using url: " << this->urlPrefix);
+	BOOST_ASSERT_MSG(!this->endpoints.empty(), "no GUI url given");
+	BOOST_FOREACH(GuiEndpoint const & endpoint, this->endpoints)
+	{
+		DLOG("using url: " << endpoint.url);
+	}
 }
 
 
@@ -126,20 +841,9 @@ GuiProxyImpl::~GuiProxyImpl()
 
 static size_t dataReceived(const void *ptr, size_t size, size_t nmemb, void *userp)
 {
-	try
-	{
-		size_t sizeOfAvailData = size*nmemb;
-
-		std::stringstream ss;
-		ss << std::string{static_cast<char const *>(ptr), sizeOfAvailData};
-		boost::property_tree::read_json(ss, *static_cast<pt::ptree*>(userp));
-		return sizeOfAvailData;
-	}
-	catch (pt::json_parser::json_parser_error const & parseError)
-	{
-		ELOG("could not parse response, " << parseError.what());
-		return 0;
-	}
+	size_t sizeOfAvailData = size*nmemb;
+	static_cast<std::string*>(userp)->append(static_cast<char const *>(ptr), sizeOfAvailData);
+	return sizeOfAvailData;
 }
 
 
@@ -151,63 +855,417 @@ GuiProxyImpl::workerMain()
 		GuiRequest requestToProcess;
 		{
 			boost::mutex::scoped_lock lck(this->mtx);
-			while (this->requests.empty()) this->cnd.wait(lck);
-			requestToProcess = this->requests.front();
-			this->requests.pop_front();
+			while (this->requests.empty() && !this->syncDue())
+			{
+				if (this->accountIndexEnabled) this->clock.waitUntil(lck, this->cnd, this->nextAccountSync);
+				else this->cnd.wait(lck);
+			}
+
+			if (this->requests.empty() || this->syncDue())
+			{
+				lck.unlock();
+				this->syncAccounts();
+				continue;
+			}
+
+			requestToProcess = this->requests.pop();
+			this->updateOverloaded();
+		}
+
+		// slave gave up waiting long ago, do not spend GUI time on it
+		if (requestToProcess.callback != nullptr &&
+			this->clock.now() - requestToProcess.queuedAt > this->maxQueueWait)
+		{
+			WLOG("request expired in queue: " << requestToProcess);
+			{
+				boost::mutex::scoped_lock lck(this->mtx);
+				++this->expiredRequests;
+			}
+			requestToProcess.callback->timeout();
+			continue;
 		}
 
 		LOG("sending request: " << requestToProcess);
 
-		std::unique_ptr<CURL, void(*)(CURL*)> curl(curl_easy_init(), curl_easy_cleanup);
-		BOOST_ASSERT_MSG(curl.get() != nullptr, "curl initialization failed");
-		
-		curl_easy_setopt(curl.get(), CURLOPT_URL, requestToProcess.path.c_str());
-		curl_easy_setopt(curl.get(), CURLOPT_POSTFIELDS, requestToProcess.postParams.c_str());
-		curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, dataReceived);
-		curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &requestToProcess.responseRoot);
-		//curl_easy_setopt(curl.get(), CURLOPT_VERBOSE, 1L);
+		if (requestToProcess.trace != nullptr) requestToProcess.trace->stamp(RequestTrace::GUI_SENT);
+		GuiResponse const response = this->sendRequest(requestToProcess);
+		if (requestToProcess.trace != nullptr) requestToProcess.trace->stamp(RequestTrace::GUI_ANSWERED);
+		this->deliverResponse(requestToProcess, response);
+	}
+}
+
+std::vector<GuiEndpoint*>
+GuiProxyImpl::endpointsByScore()
+{
+	std::vector<GuiEndpoint*> result;
+	boost::posix_time::ptime const now = Clock::Real().now();
+
+	boost::mutex::scoped_lock lck(this->statsMtx);
+	BOOST_FOREACH(GuiEndpoint & endpoint, this->endpoints)
+	{
+		result.push_back(&endpoint);
+	}
+	std::stable_sort(result.begin(), result.end(),
+		[now](GuiEndpoint const * a, GuiEndpoint const * b) { return a->score(now) < b->score(now); });
+	return result;
+}
+
+void
+GuiProxyImpl::startTransfer(
+	CURLM * multi, std::list<GuiTransfer> & transfers, GuiEndpoint & endpoint, GuiRequest const & request)
+{
+	transfers.emplace_back(endpoint);
+	GuiTransfer & transfer = transfers.back();
+	transfer.url = endpoint.url + "/" + request.name;
+	{
+		boost::mutex::scoped_lock lck(this->statsMtx);
+		transfer.binaryRequest = endpoint.binary;
+	}
+
+	// GUI answers in binary when it supports it, from then on requests to it are binary too
+	std::string const accept = std::string("Accept: ") + GuiCodec::BINARY_CONTENT_TYPE + ", application/json;q=0.5";
+	std::string const contentType = std::string("Content-Type: ") + GuiCodec::BINARY_CONTENT_TYPE;
+	curl_slist * headers = curl_slist_append(nullptr, accept.c_str());
+	if (transfer.binaryRequest) headers = curl_slist_append(headers, contentType.c_str());
+	transfer.headers.reset(headers);
+	std::string const & body = transfer.binaryRequest ? request.binaryBody : request.postParams;
 
-		CURLcode res = curl_easy_perform(curl.get());
-	
-		switch (res)
+	curl_easy_setopt(transfer.curl.get(), CURLOPT_URL, transfer.url.c_str());
+	curl_easy_setopt(transfer.curl.get(), CURLOPT_HTTPHEADER, transfer.headers.get());
+	curl_easy_setopt(transfer.curl.get(), CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
+	curl_easy_setopt(transfer.curl.get(), CURLOPT_POSTFIELDS, body.data());
+	curl_easy_setopt(transfer.curl.get(), CURLOPT_WRITEFUNCTION, dataReceived);
+	curl_easy_setopt(transfer.curl.get(), CURLOPT_WRITEDATA, &transfer.body);
+	curl_easy_setopt(transfer.curl.get(), CURLOPT_TIMEOUT_MS, this->timeoutMs);
+	curl_easy_setopt(transfer.curl.get(), CURLOPT_NOSIGNAL, 1L);
+	//curl_easy_setopt(transfer.curl.get(), CURLOPT_VERBOSE, 1L);
+
+	curl_multi_add_handle(multi, transfer.curl.get());
+}
+
+// Request failed before any byte of it was sent: name not resolved, connection refused or
+// connect timed out on a dead uplink. GUI can not have consumed credit for it.
+static bool neverReachedServer(GuiResponse const & response)
+{
+	return response.curlCode != CURLE_OK && response.requestBytes == 0;
+}
+
+// Sends request to the best endpoint and fails over to the next ones on errors.
+// Requests consuming credit fail over only when GUI provably never saw them,
+// otherwise the next endpoint could charge the user a second time.
+// Idempotent requests may be hedged to the second best endpoint when the first
+// one does not answer within its p95 latency; the first good answer wins.
+GuiResponse
+GuiProxyImpl::sendRequest(GuiRequest const & request)
+{
+	std::vector<GuiEndpoint*> const candidates = this->endpointsByScore();
+	size_t nextCandidate = 0;
+
+	std::unique_ptr<CURLM, CURLMcode(*)(CURLM*)> multi(curl_multi_init(), curl_multi_cleanup);
+	BOOST_ASSERT_MSG(multi.get() != nullptr, "curl multi initialization failed");
+
+	std::list<GuiTransfer> transfers;
+	boost::optional<boost::posix_time::ptime> hedgeAt;
+	GuiResponse lastFailure{CURLE_COULDNT_CONNECT, 0, {}, false, 0};
+
+	auto startNext = [&]()
+	{
+		GuiEndpoint & endpoint = *candidates[nextCandidate++];
+		this->startTransfer(multi.get(), transfers, endpoint, request);
+
+		hedgeAt = boost::none;
+		if (this->hedgeRequests && request.idempotent && nextCandidate < candidates.size())
 		{
-		case CURLE_OK:
+			boost::optional<boost::posix_time::time_duration> delay;
+			{
+				boost::mutex::scoped_lock lck(this->statsMtx);
+				delay = endpoint.hedgeDelay();
+			}
+			if (delay) hedgeAt = transfers.back().startedAt + *delay;
+		}
+	};
+
+	auto abortAll = [&]()
+	{
+		BOOST_FOREACH(GuiTransfer & transfer, transfers)
 		{
-			long httpCode = 0;
-			curl_easy_getinfo (curl.get(), CURLINFO_RESPONSE_CODE, &httpCode);
+			curl_multi_remove_handle(multi.get(), transfer.curl.get());
+		}
+		transfers.clear();
+	};
+
+	startNext();
+	while (!transfers.empty())
+	{
+		boost::this_thread::interruption_point();
 
-			if (httpCode == 200) // OK
+		int stillRunning = 0;
+		curl_multi_perform(multi.get(), &stillRunning);
+
+		CURLMsg * msg;
+		int msgsLeft;
+		while ((msg = curl_multi_info_read(multi.get(), &msgsLeft)) != nullptr)
+		{
+			if (msg->msg != CURLMSG_DONE) continue;
+
+			auto transfer = std::find_if(transfers.begin(), transfers.end(),
+				[msg](GuiTransfer const & t) { return t.curl.get() == msg->easy_handle; });
+			BOOST_ASSERT_MSG(transfer != transfers.end(), "unknown curl transfer finished");
+
+			GuiResponse response{msg->data.result, 0, std::move(transfer->body), false, 0};
+			curl_easy_getinfo(transfer->curl.get(), CURLINFO_RESPONSE_CODE, &response.httpCode);
+			curl_easy_getinfo(transfer->curl.get(), CURLINFO_REQUEST_SIZE, &response.requestBytes);
+			char * contentType = nullptr;
+			curl_easy_getinfo(transfer->curl.get(), CURLINFO_CONTENT_TYPE, &contentType);
+			response.binary = contentType != nullptr &&
+				strncmp(contentType, GuiCodec::BINARY_CONTENT_TYPE, strlen(GuiCodec::BINARY_CONTENT_TYPE)) == 0;
+			curl_multi_remove_handle(multi.get(), transfer->curl.get());
+
+			if (response.curlCode == CURLE_OK && response.httpCode == 415 && transfer->binaryRequest)
 			{
-				try
-				{
-					int32_t const creditsAvail = requestToProcess.responseRoot.get<int32_t>("credit");
-					LOG("success, creditsAvail:" << creditsAvail);
-					requestToProcess.callback->success(creditsAvail);
-				}
-				catch (pt::ptree_bad_path const &)
+				WLOG("endpoint " << transfer->endpoint.url << " rejected binary request, going back to JSON");
+				GuiEndpoint & endpoint = transfer->endpoint;
 				{
-					ELOG("there is no \"credit\" field in success response, failing request");
-					requestToProcess.callback->serverInternalError();
+					boost::mutex::scoped_lock lck(this->statsMtx);
+					endpoint.binary = false;
 				}
+				transfers.erase(transfer);
+				this->startTransfer(multi.get(), transfers, endpoint, request);
+				continue;
+			}
 
+			bool const failed = response.curlCode != CURLE_OK || response.httpCode >= 500;
+			{
+				boost::mutex::scoped_lock lck(this->statsMtx);
+				boost::posix_time::ptime const now = Clock::Real().now();
+				if (failed) transfer->endpoint.recordFailure(now);
+				else transfer->endpoint.recordSuccess(now - transfer->startedAt, now);
 			}
-			else if (httpCode == 404) // Not found
+
+			// error pages come as plain text from any GUI, only real answers tell its format
+			if (response.curlCode == CURLE_OK && response.httpCode == 200 && response.binary != transfer->endpoint.binary)
 			{
-				LOG("not found");
-				requestToProcess.callback->notFound();
+				LOG("endpoint " << transfer->endpoint.url << " answers in " << (response.binary ? "binary" : "JSON"));
+				boost::mutex::scoped_lock lck(this->statsMtx);
+				transfer->endpoint.binary = response.binary;
 			}
-			else
+
+			if (!failed)
 			{
-				ELOG("internal error, httpCode:" << httpCode);
-				requestToProcess.callback->serverInternalError();
+				if (transfers.size() > 1) LOG("hedged request answered by " << transfer->endpoint.url);
+				transfers.erase(transfer);
+				abortAll();
+				return response;
 			}
-			break;
+
+			WLOG("endpoint " << transfer->endpoint.url << " failed, curlCode:" << response.curlCode
+				<< ", httpCode:" << response.httpCode);
+			lastFailure = std::move(response);
+			transfers.erase(transfer);
+
+			if (transfers.empty() && nextCandidate < candidates.size())
+			{
+				if (!request.idempotent && !neverReachedServer(lastFailure))
+				{
+					WLOG("not failing over " << request.name << ", GUI may have consumed credit already");
+					break;
+				}
+				LOG("failing over to " << candidates[nextCandidate]->url);
+				startNext();
+			}
+		}
+
+		if (hedgeAt && transfers.size() == 1 && nextCandidate < candidates.size() &&
+			Clock::Real().now() >= *hedgeAt)
+		{
+			LOG("hedging request to " << candidates[nextCandidate]->url);
+			startNext();
+			hedgeAt = boost::none;
 		}
-		default:
-			LOG("request failed, curlCode:" << res << ", error:" << curl_easy_strerror(res));
-			requestToProcess.callback->serverInternalError();
-			break;
+
+		if (!transfers.empty()) curl_multi_wait(multi.get(), nullptr, 0, 20, nullptr);
+	}
+
+	return lastFailure;
+}
+
+bool
+GuiProxyImpl::syncDue() const
+{
+	return this->accountIndexEnabled && this->clock.now() >= this->nextAccountSync;
+}
+
+// Requeues consumption reports that did not reach GUI and fetches accounts changed
+// since last sync (all of them on first sync). Reports go through the background tier,
+// so a backlog of them after an outage does not hold back logins.
+void
+GuiProxyImpl::syncAccounts()
+{
+	auto const now = this->clock.now();
+	this->nextAccountSync = now + this->accountSyncInterval;
+
+	std::list<GuiRequest> toRetry;
+	{
+		boost::mutex::scoped_lock lck(this->accountIndexMtx);
+		toRetry.swap(this->failedReconciliations);
+	}
+	if (!toRetry.empty())
+	{
+		LOG("requeuing " << toRetry.size() << " consumption reports");
+		boost::mutex::scoped_lock lck(this->mtx);
+		BOOST_FOREACH(GuiRequest & request, toRetry)
+		{
+			request.queuedAt = now;
+			this->requests.push(request);
 		}
+		this->updateOverloaded();
+	}
+
+	uint64_t sinceVersion;
+	{
+		boost::mutex::scoped_lock lck(this->accountIndexMtx);
+		sinceVersion = this->accountIndex.version;
+	}
+
+	GuiRequest const syncRequest{
+		"getusers", "since=" + boost::lexical_cast<std::string>(sinceVersion),
+		GuiCodec::EncodeRequest(GuiCodec::Request{GuiCodec::RequestKind::ACCOUNTS, sinceVersion, 0, 0}), true,
+		this->clock.now(), AccountKey{}, 0, nullptr, nullptr};
+	GuiResponse const response = this->sendRequest(syncRequest);
+	if (response.curlCode != CURLE_OK || response.httpCode != 200)
+	{
+		WLOG("accounts sync failed, curlCode:" << response.curlCode << ", httpCode:" << response.httpCode);
+		return;
+	}
+
+	uint64_t newVersion;
+	std::list<GuiCodec::Account> accounts;
+	if (!GuiCodec::DecodeAccounts(response.body, response.binary, newVersion, accounts))
+	{
+		ELOG("could not parse accounts sync response");
+		return;
+	}
+
+	std::list<AccountIndex::Account> changed;
+	std::list<WaterClient::UserId> deleted;
+	BOOST_FOREACH(GuiCodec::Account const & account, accounts)
+	{
+		if (account.deleted) deleted.push_back(account.userId);
+		else changed.push_back(AccountIndex::Account{account.userId, account.pin, account.rfidId, account.credit, 0});
+	}
+
+	{
+		boost::mutex::scoped_lock lck(this->accountIndexMtx);
+		BOOST_FOREACH(AccountIndex::Account const & account, changed) this->accountIndex.update(account);
+		BOOST_FOREACH(WaterClient::UserId const userId, deleted) this->accountIndex.remove(userId);
+		this->accountIndex.version = newVersion;
+		this->accountIndex.loaded = true;
+	}
+
+	{
+		// accounts registered since they were cached as not found
+		boost::mutex::scoped_lock lck(this->negativeCacheMtx);
+		BOOST_FOREACH(AccountIndex::Account const & account, changed)
+		{
+			this->negativeCache.erase(AccountKey{AccountKey::Type::ID_PIN, account.userId, account.pin});
+			if (account.rfidId) this->negativeCache.erase(AccountKey{AccountKey::Type::RFID, *account.rfidId, 0});
+		}
+	}
+
+	LOG("accounts synced since version " << sinceVersion << " to " << newVersion
+		<< ", changed:" << changed.size() << ", deleted:" << deleted.size());
+}
+
+void
+GuiProxyImpl::deliverReconciliation(GuiRequest const & request, GuiResponse const & response)
+{
+	boost::mutex::scoped_lock lck(this->accountIndexMtx);
+
+	if (response.curlCode == CURLE_OK && response.httpCode == 200)
+	{
+		WaterClient::Credit guiCredit;
+		if (GuiCodec::DecodeCredit(response.body, response.binary, guiCredit))
+		{
+			this->accountIndex.reconcile(request.accountKey, request.creditToConsume, guiCredit);
+			return;
+		}
+		ELOG("could not parse consumption report response");
+	}
+	else if (response.curlCode == CURLE_OK && response.httpCode == 404)
+	{
+		ELOG("account vanished from GUI, consumption lost: " << request);
+		this->accountIndex.remove(request.accountKey);
+		return;
+	}
+	else if (neverReachedServer(response))
+	{
+		WLOG("consumption report did not reach GUI, will retry: " << request);
+		if (this->failedReconciliations.size() >= MAX_FAILED_RECONCILIATIONS)
+		{
+			GuiRequest const & oldest = this->failedReconciliations.front();
+			ELOG("too many consumption reports waiting, consumption lost: " << oldest);
+			this->accountIndex.remove(oldest.accountKey);
+			this->failedReconciliations.pop_front();
+		}
+		this->failedReconciliations.push_back(request);
+		return;
+	}
+
+	// GUI may have applied it (timeout, 5xx) or rejected it for good (4xx), resending could
+	// charge twice or fail forever. Local credit can not be trusted any more, so the account
+	// is left to GUI until a sync reports it changed.
+	ELOG("consumption report failed, curlCode:" << response.curlCode << ", httpCode:" << response.httpCode
+		<< ", leaving account to GUI: " << request);
+	this->accountIndex.remove(request.accountKey);
+}
+
+void
+GuiProxyImpl::deliverResponse(GuiRequest const & request, GuiResponse const & response)
+{
+	if (request.callback == nullptr)
+	{
+		this->deliverReconciliation(request, response);
+		return;
+	}
+
+	if (response.curlCode != CURLE_OK)
+	{
+		LOG("request failed, curlCode:" << response.curlCode << ", error:" << curl_easy_strerror(response.curlCode));
+		request.callback->serverInternalError();
+		return;
+	}
+
+	if (response.httpCode == 200) // OK
+	{
+		WaterClient::Credit creditsAvail;
+		if (!GuiCodec::DecodeCredit(response.body, response.binary, creditsAvail))
+		{
+			ELOG("there is no valid credit in success response, failing request");
+			request.callback->serverInternalError();
+			return;
+		}
+
+		LOG("success, creditsAvail:" << creditsAvail);
+		if (this->accountIndexEnabled)
+		{
+			boost::mutex::scoped_lock lck(this->accountIndexMtx);
+			this->accountIndex.updateCredit(request.accountKey, creditsAvail);
+		}
+		request.callback->success(creditsAvail);
+	}
+	else if (response.httpCode == 404) // Not found
+	{
+		LOG("not found");
+		{
+			boost::mutex::scoped_lock lck(this->negativeCacheMtx);
+			this->negativeCache.insert(request.accountKey, this->clock.now());
+		}
+		request.callback->notFound();
+	}
+	else
+	{
+		ELOG("internal error, httpCode:" << response.httpCode);
+		request.callback->serverInternalError();
 	}
 }
 
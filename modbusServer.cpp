@@ -49,7 +49,7 @@ public:
 	virtual int writeRegisters(int addr, int nb, const uint16_t *data)
 	{
 		auto retVal = modbus_write_registers(this->ctx.get(), addr, nb, data);
-		if (retVal != 1)
+		if (retVal == -1)
 		{
 			ELOG("modbus writing failed " << modbus_strerror(errno));
 		}
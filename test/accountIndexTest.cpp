@@ -0,0 +1,222 @@
+#include "standInGui.h"
+#include "log4cxx/basicconfigurator.h"
+#include "log4cxx/helpers/exception.h"
+#include <atomic>
+#include <boost/foreach.hpp>
+
+namespace waterServer
+{
+
+log4cxx::LoggerPtr logger{log4cxx::Logger::getLogger("waterServer")};
+
+WaterClient::UserId const USER_ID = 7;
+WaterClient::Pin const PIN = 1234;
+WaterClient::RfidId const RFID = 5;
+WaterClient::RfidId const UNKNOWN_RFID = 6;
+
+// GUI knowing one account, another dispenser may consume 10 from it before the first report arrives
+class AccountGui
+{
+	bool consumedElsewhere;
+
+public:
+
+	std::atomic<WaterClient::Credit> credit;
+	std::atomic<int> reportStatus; // answer to consumption reports
+	StandInGui gui;
+
+	AccountGui(bool const othersConsume) :
+		consumedElsewhere(!othersConsume),
+		credit(100),
+		reportStatus(200),
+		gui([this](StandInGui::Request const & request) { return this->answer(request); })
+	{}
+
+	size_t reports()
+	{
+		size_t count = 0;
+		BOOST_FOREACH(StandInGui::Request const & request, this->gui.received())
+		{
+			if (request.name == "getuser_rfid" && StandInGui::Consumed(request) > 0) ++count;
+		}
+		return count;
+	}
+
+private:
+
+	StandInGui::Answer answer(StandInGui::Request const & request)
+	{
+		if (request.name == "getusers")
+		{
+			std::list<GuiCodec::Account> accounts;
+			if (StandInGui::Param(request, "since") == "0")
+			{
+				accounts.push_back(GuiCodec::Account{USER_ID, PIN, RFID, this->credit, false});
+			}
+			if (request.acceptsBinary)
+			{
+				return StandInGui::Answer{200, GuiCodec::EncodeAccounts(1, accounts), GuiCodec::BINARY_CONTENT_TYPE, 0};
+			}
+			std::string users;
+			BOOST_FOREACH(GuiCodec::Account const & account, accounts)
+			{
+				users += "{\"client_id\":" + boost::lexical_cast<std::string>(account.userId) +
+					",\"pin\":" + boost::lexical_cast<std::string>(account.pin) +
+					",\"client_rfid\":" + boost::lexical_cast<std::string>(*account.rfidId) +
+					",\"credit\":" + boost::lexical_cast<std::string>(account.credit) + "}";
+			}
+			return StandInGui::Answer{200, "{\"version\":1,\"users\":[" + users + "]}", "application/json", 0};
+		}
+
+		if (StandInGui::Param(request, "client_rfid") != boost::lexical_cast<std::string>(RFID))
+		{
+			return StandInGui::Answer{404, "", "text/plain", 0};
+		}
+
+		WaterClient::Credit const consumed = StandInGui::Consumed(request);
+		if (consumed > 0 && this->reportStatus != 200) return StandInGui::Answer{this->reportStatus, "", "text/plain", 0};
+
+		int delayMs = 0;
+		if (consumed > 0 && !this->consumedElsewhere)
+		{
+			// keeps the first report in flight while the next consumption is answered locally
+			this->consumedElsewhere = true;
+			this->credit -= 10;
+			delayMs = 300;
+		}
+		this->credit -= consumed;
+		return StandInGui::Credit(request, this->credit, delayMs);
+	}
+};
+
+void waitForIndex(GuiProxy & gp, std::string const & state)
+{
+	std::ostringstream index;
+	while (index.str().find(state) == std::string::npos)
+	{
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		index.str("");
+		gp.dumpAccountIndex(index);
+	}
+}
+
+// reports are sent one by one, a lookup GUI has to answer is served after the ones already sent
+void waitForReports(AccountGui & gui, GuiProxy & gp, size_t const reports)
+{
+	while (gui.reports() < reports) boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
+	StandInCallback cb;
+	gp.clearNegativeCache();
+	gp.handleRfidRequest(UNKNOWN_RFID, 0, &cb);
+	cb.waitForReply();
+}
+
+std::unique_ptr<GuiProxy> createLoadedGuiProxy(AccountGui & gui)
+{
+	GuiProxy::Config config;
+	config.urls.push_back(gui.gui.url());
+	config.accountIndex = true;
+	config.accountSyncIntervalSec = 1;
+	config.timeoutSec = 1;
+	std::unique_ptr<GuiProxy> gp = GuiProxy::CreateDefault(config);
+
+	waitForIndex(*gp, "accounts:1");
+	return gp;
+}
+
+bool accountIndexTest()
+{
+	AccountGui gui(true);
+	std::unique_ptr<GuiProxy> const gp = createLoadedGuiProxy(gui);
+	std::ostringstream index;
+
+	// consumed locally, then GUI credit from first report is 10 lower than expected
+	StandInCallback cb;
+	gp->handleRfidRequest(RFID, 10, &cb);
+	bool ok = cb.waitForReply() == 90;
+	gp->handleRfidRequest(RFID, 5, &cb);
+	ok = ok && cb.waitForReply() == 85;
+
+	waitForReports(gui, *gp, 2);
+	gp->handleRfidRequest(RFID, 0, &cb);
+	ok = ok && cb.waitForReply() == 75 && gui.credit == 75;
+
+	index.str("");
+	gp->dumpAccountIndex(index);
+	ok = ok && index.str().find("conflicts:1") != std::string::npos;
+	LOG("reconciled with conflict, " << index.str());
+
+	// rejected report is not retried, account is answered by GUI from then on
+	gui.reportStatus = 409;
+	gp->handleRfidRequest(RFID, 5, &cb);
+	ok = ok && cb.waitForReply() == 70;
+	waitForReports(gui, *gp, 3);
+
+	gp->handleRfidRequest(RFID, 0, &cb);
+	ok = ok && cb.waitForReply() == 75;
+
+	boost::this_thread::sleep(boost::posix_time::milliseconds(1500));
+	ok = ok && gui.reports() == 3;
+
+	LOG("account index reconciliation " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+// report timing out on connect never reached GUI, it is kept and sent once GUI is back
+bool deadUplinkTest()
+{
+	AccountGui gui(false);
+	std::unique_ptr<GuiProxy> const gp = createLoadedGuiProxy(gui);
+
+	gui.gui.setAccepting(false);
+	StandInCallback cb;
+	gp->handleRfidRequest(RFID, 10, &cb);
+	bool ok = cb.waitForReply() == 90;
+
+	// report timed out and was requeued, account is still answered locally instead of by dead GUI
+	boost::this_thread::sleep(boost::posix_time::milliseconds(1500));
+	gp->handleRfidRequest(RFID, 0, &cb);
+	ok = ok && cb.waitForReply() == 90 && gui.reports() == 0;
+	if (!ok)
+	{
+		LOG("dead uplink FAILED, report was dropped");
+		return false;
+	}
+
+	gui.gui.setAccepting(true);
+	waitForReports(gui, *gp, 1);
+	gp->handleRfidRequest(RFID, 0, &cb);
+	ok = ok && cb.waitForReply() == 90 && gui.credit == 90;
+
+	std::ostringstream index;
+	gp->dumpAccountIndex(index);
+	ok = ok && index.str().find("conflicts:0") != std::string::npos;
+
+	LOG("dead uplink " << (ok ? "passed" : "FAILED") << ", " << index.str());
+	return ok;
+}
+
+int accountIndexTestMain()
+{
+	try
+	{
+		log4cxx::BasicConfigurator::configure();
+		GuiProxy::GlobalInit();
+
+		bool const ok = accountIndexTest() && deadUplinkTest();
+
+		GuiProxy::GlobalCleanup();
+		return ok ? 0 : 1;
+	}
+	catch(log4cxx::helpers::Exception&)
+	{
+		return 1;
+	}
+}
+
+}
+
+int main()
+{
+	return waterServer::accountIndexTestMain();
+}
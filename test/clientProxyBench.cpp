@@ -0,0 +1,138 @@
+#include "../waterServer.h"
+#include "log4cxx/basicconfigurator.h"
+#include "log4cxx/helpers/exception.h"
+#include "log4cxx/level.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// counts heap bytes so memory per slave can be reported
+static size_t allocatedBytes = 0;
+
+void * operator new(size_t size)
+{
+	allocatedBytes += size;
+	void * p = std::malloc(size);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void * p) noexcept
+{
+	std::free(p);
+}
+
+namespace waterServer
+{
+
+log4cxx::LoggerPtr logger{log4cxx::Logger::getLogger("waterServer")};
+
+// every slave answers with its current request, a new one comes every hundred rounds
+class BenchModbusServer : public ModbusServer
+{
+	size_t const slavesCount;
+	uint32_t reads;
+
+public:
+
+	BenchModbusServer(size_t slavesCountArg) : slavesCount(slavesCountArg), reads(0) {}
+
+	virtual void setSlave(int) {}
+
+	virtual int readRegisters(int, int nb, uint16_t * dest)
+	{
+		WaterClient::RequestSeqNum const seqNum = 1 + this->reads++ / this->slavesCount / 100;
+
+		WaterClient::Request rq;
+		memset(&rq, 0, sizeof(rq));
+		rq.requestSeqNumAtBegin = rq.requestSeqNumAtEnd = seqNum;
+		rq.requestType = water::RequestType::LOGIN_BY_RFID;
+		rq.impl.loginByRfid.rfidId = this->reads;
+		memcpy(dest, &rq, std::min<size_t>(sizeof(rq), nb * sizeof(uint16_t)));
+		return nb;
+	}
+
+	virtual int writeRegisters(int, int nb, const uint16_t *) { return nb; }
+};
+
+// answers right away, so the benchmark measures the poll loop only
+class BenchGuiProxy : public GuiProxy
+{
+public:
+
+	unsigned long requests = 0;
+
+	virtual void handleIdPinRequest(WaterClient::UserId, WaterClient::Pin, WaterClient::Credit, Callback * cb)
+	{
+		++this->requests;
+		cb->success(100);
+	}
+
+	virtual void handleRfidRequest(WaterClient::RfidId, WaterClient::Credit, Callback * cb)
+	{
+		++this->requests;
+		cb->success(100);
+	}
+
+	virtual void dumpQueue(std::ostream &) {}
+	virtual void dumpEndpoints(std::ostream &) {}
+	virtual void dumpNegativeCache(std::ostream &) {}
+	virtual void clearNegativeCache() {}
+	virtual void dumpAccountIndex(std::ostream &) {}
+	virtual bool isOverloaded() { return false; }
+};
+
+void clientProxyBench(size_t const slavesCount, unsigned const rounds)
+{
+	std::list<WaterClient::SlaveId> slaveIds;
+	for (size_t i = 0; i < slavesCount; ++i) slaveIds.push_back(1 + i % 247); // ids repeat, as on many buses
+
+	BenchModbusServer modbusServer(slavesCount);
+	BenchGuiProxy guiProxy;
+
+	size_t const before = allocatedBytes;
+	std::unique_ptr<ClientProxy> clientProxy = ClientProxy::CreateDefault(
+		guiProxy, modbusServer, slaveIds, ClientProxy::Config());
+	size_t const memoryPerSlave = (allocatedBytes - before) / slavesCount;
+
+	auto const start = std::chrono::steady_clock::now();
+	for (unsigned round = 0; round < rounds; ++round)
+	{
+		clientProxy->pollRound();
+	}
+	auto const elapsed = std::chrono::steady_clock::now() - start;
+	double const nsPerVisit =
+		std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(slavesCount) * rounds);
+
+	std::cout << "slaves:" << slavesCount
+		<< " rounds:" << rounds
+		<< " bytesPerSlave:" << memoryPerSlave
+		<< " nsPerSlaveVisit:" << nsPerVisit
+		<< " usPerRound:" << nsPerVisit * slavesCount / 1000
+		<< " guiRequests:" << guiProxy.requests << "\n";
+}
+
+int clientProxyBenchMain()
+{
+	try
+	{
+		log4cxx::BasicConfigurator::configure();
+		logger->setLevel(log4cxx::Level::getWarn());
+
+		clientProxyBench(10000, 1000);
+	}
+	catch(log4cxx::helpers::Exception&)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+}
+
+int main()
+{
+	return waterServer::clientProxyBenchMain();
+}
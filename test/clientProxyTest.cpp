@@ -0,0 +1,223 @@
+#include "../waterServer.h"
+#include "log4cxx/basicconfigurator.h"
+#include "log4cxx/helpers/exception.h"
+#include "log4cxx/level.h"
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <set>
+
+namespace waterServer
+{
+
+log4cxx::LoggerPtr logger{log4cxx::Logger::getLogger("waterServer")};
+
+// RS-485 bus where every transfer costs simulated time, offline slaves cost the whole timeout.
+// User at every slave logs in again as soon as the previous login got its reply, unless
+// the slave goes idle after some logins and keeps showing its last request.
+class SimulatedModbusServer : public ModbusServer
+{
+public:
+
+	// how a slave mistreats the reply to each login
+	struct Behaviour
+	{
+		unsigned missedReplies; // written replies slave does not take
+		unsigned failedWrites; // writes failing before one gets through
+		unsigned maxLogins; // slave goes idle after that many, 0 for never
+	};
+
+	struct SlaveStats
+	{
+		unsigned reads = 0;
+		unsigned writes = 0; // successful ones
+		unsigned logins = 0;
+		WaterClient::RequestSeqNum seqNum = 0;
+
+		// of current login
+		bool replyTaken = false;
+		unsigned missedReplies = 0;
+		unsigned failedWrites = 0;
+	};
+	std::map<int, SlaveStats> stats;
+
+	SimulatedModbusServer(Clock & clockArg, std::set<int> const & offlineArg, std::map<int, Behaviour> const & behavioursArg) :
+		clock(clockArg), offline(offlineArg), behaviours(behavioursArg), currentSlave(0) {}
+
+	virtual void setSlave(int slave) { this->currentSlave = slave; }
+
+	virtual int readRegisters(int, int nb, uint16_t * dest)
+	{
+		if (this->offline.count(this->currentSlave) != 0)
+		{
+			this->clock.sleepFor(boost::posix_time::seconds(2));
+			return -1;
+		}
+		this->clock.sleepFor(boost::posix_time::milliseconds(50));
+
+		SlaveStats & slave = this->stats[this->currentSlave];
+		++slave.reads;
+		auto const behaviour = this->behaviours.find(this->currentSlave);
+		bool const idle = behaviour != this->behaviours.end() && behaviour->second.maxLogins != 0 &&
+			slave.logins >= behaviour->second.maxLogins;
+		if (slave.logins == 0 || (slave.replyTaken && !idle))
+		{
+			++slave.logins;
+			++slave.seqNum;
+			slave.replyTaken = false;
+			slave.missedReplies = 0;
+			slave.failedWrites = 0;
+		}
+
+		WaterClient::Request rq;
+		memset(&rq, 0, sizeof(rq));
+		rq.requestSeqNumAtBegin = rq.requestSeqNumAtEnd = slave.seqNum;
+		rq.requestType = water::RequestType::LOGIN_BY_RFID;
+		rq.impl.loginByRfid.rfidId = this->currentSlave;
+		memcpy(dest, &rq, std::min<size_t>(sizeof(rq), nb * sizeof(uint16_t)));
+		return nb;
+	}
+
+	virtual int writeRegisters(int, int nb, const uint16_t *)
+	{
+		this->clock.sleepFor(boost::posix_time::milliseconds(50));
+
+		SlaveStats & slave = this->stats[this->currentSlave];
+		auto const behaviour = this->behaviours.find(this->currentSlave);
+		if (behaviour != this->behaviours.end() && slave.failedWrites < behaviour->second.failedWrites)
+		{
+			++slave.failedWrites;
+			return -1;
+		}
+
+		++slave.writes;
+		if (behaviour != this->behaviours.end() && slave.missedReplies < behaviour->second.missedReplies) ++slave.missedReplies;
+		else slave.replyTaken = true;
+		return nb;
+	}
+
+private:
+
+	Clock & clock;
+	std::set<int> const offline;
+	std::map<int, Behaviour> const behaviours;
+	int currentSlave;
+};
+
+class SimulatedGuiProxy : public GuiProxy
+{
+public:
+
+	std::map<WaterClient::RfidId, unsigned long> requests; // slaves log in with their id as rfid
+
+	virtual void handleIdPinRequest(WaterClient::UserId, WaterClient::Pin, WaterClient::Credit, Callback * cb)
+	{
+		cb->success(100);
+	}
+
+	virtual void handleRfidRequest(WaterClient::RfidId rfidId, WaterClient::Credit, Callback * cb)
+	{
+		++this->requests[rfidId];
+		cb->success(100);
+	}
+
+	virtual void dumpQueue(std::ostream &) {}
+	virtual void dumpEndpoints(std::ostream &) {}
+	virtual void dumpNegativeCache(std::ostream &) {}
+	virtual void clearNegativeCache() {}
+	virtual void dumpAccountIndex(std::ostream &) {}
+	virtual bool isOverloaded() { return false; }
+};
+
+struct FleetResult
+{
+	std::map<WaterClient::RfidId, unsigned long> guiRequests;
+	std::map<int, SimulatedModbusServer::SlaveStats> stats;
+};
+
+FleetResult runFleet(boost::posix_time::time_duration const duration)
+{
+	boost::posix_time::ptime const start(boost::gregorian::date(2020, 1, 1));
+	std::unique_ptr<Clock> const clock = Clock::CreateSimulated(start);
+
+	std::list<WaterClient::SlaveId> const slaveIds{101, 102, 103, 104, 105, 106};
+	// 102 takes only every third written reply, 104 fails two writes of every reply,
+	// 105 goes idle after one login, 106 fails more writes than the reply is tried
+	SimulatedModbusServer modbusServer(*clock, {103}, {
+		{102, {2, 0, 0}}, {104, {0, 2, 0}}, {105, {0, 0, 1}}, {106, {0, 3, 0}}});
+	SimulatedGuiProxy guiProxy;
+
+	ClientProxy::Config config;
+	config.clock = clock.get();
+	std::unique_ptr<ClientProxy> const clientProxy = ClientProxy::CreateDefault(guiProxy, modbusServer, slaveIds, config);
+	clientProxy->runUntil(start + duration);
+
+	return FleetResult{guiProxy.requests, modbusServer.stats};
+}
+
+bool clientProxyTest()
+{
+	auto const wallStart = std::chrono::steady_clock::now();
+	FleetResult const first = runFleet(boost::posix_time::hours(4));
+	FleetResult const second = runFleet(boost::posix_time::hours(4));
+	auto const wallMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - wallStart).count();
+
+	bool ok = first.stats.count(103) == 0 && first.guiRequests == second.guiRequests;
+	for (int slave : {101, 102, 104, 105, 106})
+	{
+		auto const & a = first.stats.at(slave);
+		auto const & b = second.stats.at(slave);
+		unsigned long const guiRequests = first.guiRequests.at(slave);
+		LOG("slave:" << slave << " reads:" << a.reads << " writes:" << a.writes << " logins:" << a.logins
+			<< " guiRequests:" << guiRequests);
+
+		ok = ok && a.reads == b.reads && a.writes == b.writes && a.logins == b.logins && a.reads > 1;
+	}
+
+	// every login but the last one, still waiting for its reply, got it
+	auto const & healthy = first.stats.at(101);
+	ok = ok && healthy.writes + 1 == healthy.logins && first.guiRequests.at(101) == healthy.logins;
+
+	// missed reply is written again until slave takes it, GUI is asked once per login
+	auto const & missing = first.stats.at(102);
+	ok = ok && missing.writes / 3 + 1 == missing.logins && first.guiRequests.at(102) == missing.logins;
+
+	// failed writes are retried, GUI is asked once per login
+	auto const & failing = first.stats.at(104);
+	ok = ok && failing.writes + 1 == failing.logins && first.guiRequests.at(104) == failing.logins;
+
+	// idle slave keeps showing its answered request, it is never sent to GUI again
+	// and its reply is rewritten only a bounded number of times
+	auto const & idle = first.stats.at(105);
+	ok = ok && idle.logins == 1 && first.guiRequests.at(105) == 1 && idle.writes == 3;
+
+	// reply that could not be written is given up, the request is not sent to GUI again
+	auto const & broken = first.stats.at(106);
+	ok = ok && broken.logins == 1 && first.guiRequests.at(106) == 1 && broken.writes == 0;
+
+	LOG("simulated 2x4h in " << wallMs << "ms, " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+int clientProxyTestMain()
+{
+	try
+	{
+		log4cxx::BasicConfigurator::configure();
+		logger->setLevel(log4cxx::Level::getInfo());
+
+		return clientProxyTest() ? 0 : 1;
+	}
+	catch(log4cxx::helpers::Exception&)
+	{
+		return 1;
+	}
+}
+
+}
+
+int main()
+{
+	return waterServer::clientProxyTestMain();
+}
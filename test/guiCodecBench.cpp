@@ -0,0 +1,98 @@
+#include "../waterServer.h"
+#include "log4cxx/basicconfigurator.h"
+#include "log4cxx/helpers/exception.h"
+#include <chrono>
+#include <sstream>
+
+namespace waterServer
+{
+
+log4cxx::LoggerPtr logger{log4cxx::Logger::getLogger("waterServer")};
+
+template <class F>
+double nsPerCall(unsigned const calls, F const & f)
+{
+	auto const start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < calls; ++i) f(i);
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+}
+
+std::string accountsJson(uint64_t const version, std::list<GuiCodec::Account> const & accounts)
+{
+	std::ostringstream osek;
+	osek << "{\"version\":" << version << ",\"users\":[";
+	bool first = true;
+	for (GuiCodec::Account const & account : accounts)
+	{
+		osek << (first ? "" : ",") << "{\"client_id\":" << account.userId << ",\"pin\":" << account.pin
+			<< ",\"client_rfid\":" << *account.rfidId << ",\"credit\":" << account.credit << "}";
+		first = false;
+	}
+	osek << "]}";
+	return osek.str();
+}
+
+// decoding cost and size of the answers GUI sends most: credit after login and accounts sync
+void guiCodecBench(unsigned const calls, unsigned const accountsCount)
+{
+	std::string const creditJson = "{\"credit\":1234}";
+	std::string const creditBinary = GuiCodec::EncodeCredit(1234);
+
+	WaterClient::Credit credit = 0;
+	double const creditJsonNs = nsPerCall(calls, [&](unsigned) { GuiCodec::DecodeCredit(creditJson, false, credit); });
+	double const creditBinaryNs = nsPerCall(calls, [&](unsigned) { GuiCodec::DecodeCredit(creditBinary, true, credit); });
+
+	std::string const requestForm = "client_rfid=1234567890&consumed_credit=25";
+	std::string const requestBinary =
+		GuiCodec::EncodeRequest(GuiCodec::Request{GuiCodec::RequestKind::RFID, 1234567890, 0, 25});
+
+	std::list<GuiCodec::Account> accounts;
+	for (unsigned i = 0; i < accountsCount; ++i)
+	{
+		accounts.push_back(GuiCodec::Account{1000 + i, static_cast<WaterClient::Pin>(i % 10000), 3000000 + i, 500, false});
+	}
+	std::string const syncJson = accountsJson(7, accounts);
+	std::string const syncBinary = GuiCodec::EncodeAccounts(7, accounts);
+
+	unsigned const syncCalls = std::max(1u, calls / accountsCount);
+	uint64_t version = 0;
+	double const syncJsonNs = nsPerCall(syncCalls, [&](unsigned)
+	{
+		std::list<GuiCodec::Account> decoded;
+		GuiCodec::DecodeAccounts(syncJson, false, version, decoded);
+	});
+	double const syncBinaryNs = nsPerCall(syncCalls, [&](unsigned)
+	{
+		std::list<GuiCodec::Account> decoded;
+		GuiCodec::DecodeAccounts(syncBinary, true, version, decoded);
+	});
+
+	std::cout << "request bytes json:" << requestForm.size() << " binary:" << requestBinary.size() << "\n"
+		<< "credit bytes json:" << creditJson.size() << " binary:" << creditBinary.size()
+		<< " nsPerDecode json:" << creditJsonNs << " binary:" << creditBinaryNs << "\n"
+		<< "sync of " << accountsCount << " accounts bytes json:" << syncJson.size() << " binary:" << syncBinary.size()
+		<< " usPerDecode json:" << syncJsonNs / 1000 << " binary:" << syncBinaryNs / 1000 << "\n";
+}
+
+int guiCodecBenchMain()
+{
+	try
+	{
+		log4cxx::BasicConfigurator::configure();
+
+		guiCodecBench(100000, 1000);
+	}
+	catch(log4cxx::helpers::Exception&)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+}
+
+int main()
+{
+	return waterServer::guiCodecBenchMain();
+}
@@ -0,0 +1,110 @@
+#include "standInGui.h"
+#include "log4cxx/basicconfigurator.h"
+#include "log4cxx/helpers/exception.h"
+#include <atomic>
+
+namespace waterServer
+{
+
+log4cxx::LoggerPtr logger{log4cxx::Logger::getLogger("waterServer")};
+
+// first request goes as form post, the rest as the endpoint answered
+bool guiCodecTest(bool const binarySupported)
+{
+	// answers getuser_rfid with credit 100 minus consumption, binary only when supported
+	StandInGui gui([binarySupported](StandInGui::Request const & request)
+	{
+		if (request.binary && !binarySupported) return StandInGui::Answer{415, "", "text/plain", 0};
+		StandInGui::Request answerFormat = request;
+		answerFormat.acceptsBinary = request.acceptsBinary && binarySupported;
+		return StandInGui::Credit(answerFormat, 100 - StandInGui::Consumed(request));
+	});
+	GuiProxy::Config config;
+	config.urls.push_back(gui.url());
+	std::unique_ptr<GuiProxy> const gp = GuiProxy::CreateDefault(config);
+
+	StandInCallback cb;
+	bool ok = true;
+	for (WaterClient::Credit consumed = 0; consumed < 3; ++consumed)
+	{
+		gp->handleRfidRequest(11111, consumed, &cb);
+		ok = ok && cb.waitForReply() == 100 - consumed;
+	}
+
+	std::vector<StandInGui::Request> const received = gui.received();
+	ok = ok && received.size() == 3 && !received[0].binary &&
+		received[1].binary == binarySupported && received[2].binary == binarySupported;
+
+	LOG("stand-in GUI " << (binarySupported ? "with" : "without") << " binary support, "
+		<< (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+// 404 error page does not switch endpoint to JSON, losing binary support later falls back on 415
+bool guiCodecFallbackTest()
+{
+	WaterClient::RfidId const unknownRfid = 22222;
+	std::atomic<bool> binarySupported(true);
+	StandInGui gui([&binarySupported, unknownRfid](StandInGui::Request const & request)
+	{
+		if (request.binary && !binarySupported) return StandInGui::Answer{415, "", "text/plain", 0};
+		if (StandInGui::Param(request, "client_rfid") == boost::lexical_cast<std::string>(unknownRfid))
+		{
+			return StandInGui::Answer{404, "", "text/plain", 0};
+		}
+		StandInGui::Request answerFormat = request;
+		answerFormat.acceptsBinary = request.acceptsBinary && binarySupported;
+		return StandInGui::Credit(answerFormat, 100);
+	});
+	GuiProxy::Config config;
+	config.urls.push_back(gui.url());
+	std::unique_ptr<GuiProxy> const gp = GuiProxy::CreateDefault(config);
+
+	StandInCallback cb;
+	bool ok = true;
+	gp->handleRfidRequest(11111, 0, &cb);
+	ok = ok && cb.waitForReply() == 100;
+	gp->handleRfidRequest(unknownRfid, 0, &cb);
+	ok = ok && cb.waitForReply() == StandInCallback::NOT_FOUND;
+	gp->handleRfidRequest(11111, 0, &cb);
+	ok = ok && cb.waitForReply() == 100;
+
+	binarySupported = false;
+	gp->handleRfidRequest(11111, 0, &cb);
+	ok = ok && cb.waitForReply() == 100;
+	gp->handleRfidRequest(11111, 0, &cb);
+	ok = ok && cb.waitForReply() == 100;
+
+	// json, binary 404, binary, binary 415 resent as json, json
+	std::vector<StandInGui::Request> const received = gui.received();
+	ok = ok && received.size() == 6 && !received[0].binary && received[1].binary && received[2].binary &&
+		received[3].binary && !received[4].binary && !received[5].binary;
+
+	LOG("stand-in GUI dropping binary support, " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+int guiCodecTestMain()
+{
+	try
+	{
+		log4cxx::BasicConfigurator::configure();
+		GuiProxy::GlobalInit();
+
+		bool const ok = guiCodecTest(true) && guiCodecTest(false) && guiCodecFallbackTest();
+
+		GuiProxy::GlobalCleanup();
+		return ok ? 0 : 1;
+	}
+	catch(log4cxx::helpers::Exception&)
+	{
+		return 1;
+	}
+}
+
+}
+
+int main()
+{
+	return waterServer::guiCodecTestMain();
+}
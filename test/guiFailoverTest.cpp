@@ -0,0 +1,123 @@
+#include "standInGui.h"
+#include "log4cxx/basicconfigurator.h"
+#include "log4cxx/helpers/exception.h"
+#include <chrono>
+
+namespace waterServer
+{
+
+log4cxx::LoggerPtr logger{log4cxx::Logger::getLogger("waterServer")};
+
+StandInGui::Handler answering(int const status, WaterClient::Credit const credit, int const delayMs = 0)
+{
+	return [status, credit, delayMs](StandInGui::Request const & request)
+	{
+		if (status != 200) return StandInGui::Answer{status, "", "text/plain", delayMs};
+		return StandInGui::Credit(request, credit, delayMs);
+	};
+}
+
+std::unique_ptr<GuiProxy> createGuiProxy(std::list<std::string> const & urls, bool const hedgeRequests = false)
+{
+	GuiProxy::Config config;
+	config.urls = urls;
+	config.hedgeRequests = hedgeRequests;
+	return GuiProxy::CreateDefault(config);
+}
+
+// lookups fail over to the next endpoint, which is preferred afterwards
+bool lookupFailoverTest()
+{
+	StandInGui broken(answering(500, 0));
+	StandInGui healthy(answering(200, 42));
+	std::unique_ptr<GuiProxy> const gp = createGuiProxy({broken.url(), healthy.url()});
+
+	StandInCallback cb;
+	gp->handleRfidRequest(11111, 0, &cb);
+	bool ok = cb.waitForReply() == 42 && broken.received().size() == 1 && healthy.received().size() == 1;
+
+	gp->handleRfidRequest(11111, 0, &cb);
+	ok = ok && cb.waitForReply() == 42 && broken.received().size() == 1 && healthy.received().size() == 2;
+
+	LOG("lookup failover " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+// consumption that may have reached GUI is not sent again, one that provably did not is
+bool consumptionFailoverTest()
+{
+	StandInGui broken(answering(500, 0));
+	StandInGui healthy(answering(200, 42));
+
+	std::unique_ptr<GuiProxy> const toBroken = createGuiProxy({broken.url(), healthy.url()});
+	std::unique_ptr<GuiProxy> const toRefusing = createGuiProxy({"http://127.0.0.1:1", healthy.url()});
+
+	StandInCallback cb;
+	toBroken->handleRfidRequest(11111, 5, &cb);
+	bool ok = cb.waitForReply() == StandInCallback::SERVER_INTERNAL_ERROR &&
+		broken.received().size() == 1 && healthy.received().empty();
+
+	toRefusing->handleRfidRequest(11111, 5, &cb);
+	ok = ok && cb.waitForReply() == 42 && healthy.received().size() == 1;
+
+	LOG("consumption failover " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+// lookup stuck on the fast endpoint is answered by the second one after the first one's p95
+bool hedgingTest()
+{
+	StandInGui fast([](StandInGui::Request const & request)
+	{
+		bool const stuck = StandInGui::Param(request, "client_rfid") == "999";
+		return StandInGui::Credit(request, 1, stuck ? 1500 : 20);
+	});
+	StandInGui slow(answering(200, 2, 60));
+	std::unique_ptr<GuiProxy> const gp = createGuiProxy({fast.url(), slow.url()}, true);
+
+	StandInCallback cb;
+	bool ok = true;
+	for (int i = 0; i < 10; ++i)
+	{
+		gp->handleRfidRequest(11111, 0, &cb);
+		ok = ok && cb.waitForReply() > 0;
+	}
+
+	auto const start = std::chrono::steady_clock::now();
+	gp->handleRfidRequest(999, 0, &cb);
+	ok = ok && cb.waitForReply() == 2;
+	auto const elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	ok = ok && elapsedMs < 1000;
+
+	std::ostringstream endpoints;
+	gp->dumpEndpoints(endpoints);
+	LOG(endpoints.str());
+	LOG("hedged lookup answered in " << elapsedMs << "ms, " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+int guiFailoverTestMain()
+{
+	try
+	{
+		log4cxx::BasicConfigurator::configure();
+		GuiProxy::GlobalInit();
+
+		bool const ok = lookupFailoverTest() && consumptionFailoverTest() && hedgingTest();
+
+		GuiProxy::GlobalCleanup();
+		return ok ? 0 : 1;
+	}
+	catch(log4cxx::helpers::Exception&)
+	{
+		return 1;
+	}
+}
+
+}
+
+int main()
+{
+	return waterServer::guiFailoverTestMain();
+}
@@ -73,7 +73,9 @@ int guiProxyTestMain()
 		log4cxx::BasicConfigurator::configure();
 
 		LOG("Staring GuiProxy test");
-		guiProxyTest(*GuiProxy::CreateDefault("http://localhost:3000"));
+		GuiProxy::Config config;
+		config.urls.push_back("http://localhost:3000");
+		guiProxyTest(*GuiProxy::CreateDefault(config));
 
 	}
 	catch(log4cxx::helpers::Exception&)
@@ -0,0 +1,246 @@
+#include "standInGui.h"
+#include "log4cxx/basicconfigurator.h"
+#include "log4cxx/helpers/exception.h"
+#include <atomic>
+#include <boost/foreach.hpp>
+
+namespace waterServer
+{
+
+log4cxx::LoggerPtr logger{log4cxx::Logger::getLogger("waterServer")};
+
+WaterClient::RfidId const KNOWN_RFID = 5;
+
+// GUI answering logins only as far as the test lets it, so requests pile up in the queue.
+// Knows one account for the account index, getusers is always answered at once.
+class GatedGui
+{
+	std::atomic<unsigned> allowed;
+	std::atomic<unsigned> answered;
+
+public:
+
+	StandInGui gui;
+
+	GatedGui() :
+		allowed(0),
+		answered(0),
+		gui([this](StandInGui::Request const & request) { return this->answer(request); })
+	{}
+
+	void release(unsigned const count) { this->allowed += count; }
+
+	// logins and reports GUI has received, answered or not
+	size_t sent()
+	{
+		size_t count = 0;
+		BOOST_FOREACH(StandInGui::Request const & request, this->gui.received())
+		{
+			if (request.name == "getuser_rfid") ++count;
+		}
+		return count;
+	}
+
+	// order GUI received logins and reports in, R for a report, slave number for a login
+	std::string order()
+	{
+		std::string order;
+		BOOST_FOREACH(StandInGui::Request const & request, this->gui.received())
+		{
+			if (request.name != "getuser_rfid") continue;
+			if (!order.empty()) order += " ";
+			order += StandInGui::Consumed(request) > 0 ? std::string("R") :
+				boost::lexical_cast<std::string>(boost::lexical_cast<int>(StandInGui::Param(request, "client_rfid")) - 1000);
+		}
+		return order;
+	}
+
+private:
+
+	StandInGui::Answer answer(StandInGui::Request const & request)
+	{
+		if (request.name == "getusers")
+		{
+			return StandInGui::Answer{200, "{\"version\":1,\"users\":[{\"client_id\":7,\"pin\":1234,\"client_rfid\":" +
+				boost::lexical_cast<std::string>(KNOWN_RFID) + ",\"credit\":1000}]}", "application/json", 0};
+		}
+
+		while (this->answered >= this->allowed) boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+		++this->answered;
+		return StandInGui::Credit(request, 100);
+	}
+};
+
+template <class Condition> void waitFor(Condition const condition)
+{
+	while (!condition()) boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+}
+
+// capacity 8 overloads at 6 queued and recovers at 4, 9th queued request sheds the oldest one
+bool sheddingTest()
+{
+	boost::posix_time::ptime const start(boost::gregorian::date(2020, 1, 1));
+	std::unique_ptr<Clock> const clock = Clock::CreateSimulated(start);
+
+	GatedGui gui;
+	GuiProxy::Config config;
+	config.urls.push_back(gui.gui.url());
+	config.queueCapacity = 8;
+	config.maxQueueWaitSec = 20;
+	config.clock = clock.get();
+	std::unique_ptr<GuiProxy> const gp = GuiProxy::CreateDefault(config);
+
+	StandInCallback slaves[11];
+	auto const login = [&](int const slave)
+	{
+		clock->sleepFor(boost::posix_time::milliseconds(1)); // keeps queue order in queuedAt
+		gp->handleRfidRequest(1000 + slave, 0, &slaves[slave]);
+	};
+
+	// slave 0 is sent and held by GUI, the rest wait in queue
+	login(0);
+	waitFor([&]() { return gui.sent() == 1; });
+	for (int slave = 1; slave <= 5; ++slave) login(slave);
+	bool ok = !gp->isOverloaded();
+	login(6);
+	ok = ok && gp->isOverloaded();
+	login(7);
+	login(8);
+	login(9);
+	ok = ok && slaves[1].waitForReply() == StandInCallback::SERVER_INTERNAL_ERROR;
+
+	// 7, 6 and 5 queued still overloaded, 4 is not
+	for (unsigned queued = 7; queued >= 4; --queued)
+	{
+		size_t const sentBefore = gui.sent();
+		gui.release(1);
+		waitFor([&]() { return gui.sent() == sentBefore + 1; });
+		ok = ok && gp->isOverloaded() == (queued > 4);
+	}
+	login(10);
+	ok = ok && !gp->isOverloaded();
+
+	// slaves 2..4 were answered, 5 is held, the rest waited too long to be sent
+	clock->sleepFor(boost::posix_time::seconds(30));
+	gui.release(100);
+	for (int slave = 2; slave <= 5; ++slave) ok = ok && slaves[slave].waitForReply() == 100;
+	for (int slave = 6; slave <= 10; ++slave) ok = ok && slaves[slave].waitForReply() == StandInCallback::SERVER_INTERNAL_ERROR;
+	ok = ok && slaves[0].waitForReply() == 100 && gui.sent() == 5;
+
+	std::ostringstream queue;
+	gp->dumpQueue(queue);
+	ok = ok && queue.str().find("shed:1 expired:5") != std::string::npos;
+
+	LOG(queue.str());
+	LOG("shedding, expiry and hysteresis " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+// backlog of consumption reports does not throttle slaves, even at capacity 1
+bool reportBacklogTest()
+{
+	GatedGui gui;
+	GuiProxy::Config config;
+	config.urls.push_back(gui.gui.url());
+	config.queueCapacity = 1;
+	config.accountIndex = true;
+	std::unique_ptr<GuiProxy> const gp = GuiProxy::CreateDefault(config);
+
+	std::ostringstream index;
+	while (index.str().find("accounts:1") == std::string::npos)
+	{
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		index.str("");
+		gp->dumpAccountIndex(index);
+	}
+
+	// first report is held by GUI, the other ones queue up behind it
+	StandInCallback local;
+	bool ok = true;
+	for (int i = 1; i <= 20; ++i)
+	{
+		gp->handleRfidRequest(KNOWN_RFID, 1, &local);
+		ok = ok && local.waitForReply() == 1000 - i;
+	}
+	waitFor([&]() { return gui.sent() == 1; });
+	ok = ok && !gp->isOverloaded();
+
+	StandInCallback slave;
+	gp->handleRfidRequest(1001, 0, &slave);
+	ok = ok && gp->isOverloaded();
+
+	gui.release(100);
+	ok = ok && slave.waitForReply() == 100 && !gp->isOverloaded();
+	waitFor([&]() { return gui.sent() == 21; });
+	ok = ok && !gp->isOverloaded();
+
+	LOG("report backlog " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+// logins go first, a burst of reports is still served at least once per 4 logins
+bool priorityTest()
+{
+	GatedGui gui;
+	GuiProxy::Config config;
+	config.urls.push_back(gui.gui.url());
+	config.accountIndex = true;
+	std::unique_ptr<GuiProxy> const gp = GuiProxy::CreateDefault(config);
+
+	std::ostringstream index;
+	while (index.str().find("accounts:1") == std::string::npos)
+	{
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		index.str("");
+		gp->dumpAccountIndex(index);
+	}
+
+	// login of slave 0 is sent and held by GUI, it is the first of 4 logins in a row
+	StandInCallback slaves[9];
+	gp->handleRfidRequest(1000, 0, &slaves[0]);
+	waitFor([&]() { return gui.sent() == 1; });
+
+	StandInCallback local;
+	bool ok = true;
+	for (int i = 1; i <= 6; ++i)
+	{
+		gp->handleRfidRequest(KNOWN_RFID, 1, &local);
+		ok = ok && local.waitForReply() == 1000 - i;
+	}
+	for (int slave = 1; slave <= 8; ++slave) gp->handleRfidRequest(1000 + slave, 0, &slaves[slave]);
+
+	gui.release(100);
+	for (int slave = 0; slave <= 8; ++slave) ok = ok && slaves[slave].waitForReply() == 100;
+	waitFor([&]() { return gui.sent() == 15; });
+
+	std::string const order = gui.order();
+	ok = ok && order == "0 1 2 3 R 4 5 6 7 R 8 R R R R";
+
+	LOG("priority order " << order << " " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+int guiQueueTestMain()
+{
+	try
+	{
+		log4cxx::BasicConfigurator::configure();
+		GuiProxy::GlobalInit();
+
+		bool const ok = sheddingTest() && reportBacklogTest() && priorityTest();
+
+		GuiProxy::GlobalCleanup();
+		return ok ? 0 : 1;
+	}
+	catch(log4cxx::helpers::Exception&)
+	{
+		return 1;
+	}
+}
+
+}
+
+int main()
+{
+	return waterServer::guiQueueTestMain();
+}
@@ -0,0 +1,174 @@
+#include "standInGui.h"
+#include "log4cxx/basicconfigurator.h"
+#include "log4cxx/helpers/exception.h"
+#include <atomic>
+#include <boost/foreach.hpp>
+
+namespace waterServer
+{
+
+log4cxx::LoggerPtr logger{log4cxx::Logger::getLogger("waterServer")};
+
+WaterClient::RfidId const REGISTERED_RFID = 9;
+
+// GUI knowing no cards until the test registers one, then getusers reports it in version 2
+class RegisteringGui
+{
+public:
+
+	std::atomic<bool> registered;
+	StandInGui gui;
+
+	RegisteringGui() :
+		registered(false),
+		gui([this](StandInGui::Request const & request) { return this->answer(request); })
+	{}
+
+	size_t lookups()
+	{
+		size_t count = 0;
+		BOOST_FOREACH(StandInGui::Request const & request, this->gui.received())
+		{
+			if (request.name == "getuser_rfid") ++count;
+		}
+		return count;
+	}
+
+private:
+
+	StandInGui::Answer answer(StandInGui::Request const & request)
+	{
+		if (request.name == "getusers")
+		{
+			if (!this->registered) return StandInGui::Answer{200, "{\"version\":1,\"users\":[]}", "application/json", 0};
+			return StandInGui::Answer{200, "{\"version\":2,\"users\":[{\"client_id\":7,\"pin\":1234,\"client_rfid\":" +
+				boost::lexical_cast<std::string>(REGISTERED_RFID) + ",\"credit\":50}]}", "application/json", 0};
+		}
+
+		bool const known = this->registered &&
+			StandInGui::Param(request, "client_rfid") == boost::lexical_cast<std::string>(REGISTERED_RFID);
+		return known ? StandInGui::Credit(request, 50) : StandInGui::Answer{404, "", "text/plain", 0};
+	}
+};
+
+std::string dump(GuiProxy & gp)
+{
+	std::ostringstream osek;
+	gp.dumpNegativeCache(osek);
+	return osek.str();
+}
+
+// hits, misses, expiry after ttl, eviction of oldest at capacity and clearing
+bool negativeCacheTest()
+{
+	boost::posix_time::ptime const start(boost::gregorian::date(2020, 1, 1));
+	std::unique_ptr<Clock> const clock = Clock::CreateSimulated(start);
+
+	RegisteringGui gui;
+	GuiProxy::Config config;
+	config.urls.push_back(gui.gui.url());
+	config.negativeCacheSize = 3;
+	config.negativeCacheTtlSec = 60;
+	config.clock = clock.get();
+	std::unique_ptr<GuiProxy> const gp = GuiProxy::CreateDefault(config);
+
+	StandInCallback cb;
+	bool ok = true;
+	auto const lookup = [&](WaterClient::RfidId const rfid)
+	{
+		gp->handleRfidRequest(rfid, 0, &cb);
+		ok = ok && cb.waitForReply() == StandInCallback::NOT_FOUND;
+		return gui.lookups();
+	};
+
+	ok = lookup(1) == 1 && ok && lookup(1) == 1;
+	clock->sleepFor(boost::posix_time::seconds(30));
+	ok = ok && lookup(2) == 2;
+
+	// expired entry is asked again and counts as newest from then on
+	clock->sleepFor(boost::posix_time::seconds(31));
+	ok = ok && lookup(1) == 3;
+	clock->sleepFor(boost::posix_time::seconds(1));
+	ok = ok && lookup(3) == 4;
+
+	// fourth card evicts the oldest one, which is no longer the refreshed one
+	clock->sleepFor(boost::posix_time::seconds(1));
+	ok = ok && lookup(4) == 5 && lookup(1) == 5 && lookup(3) == 5 && lookup(4) == 5 && lookup(2) == 6;
+	ok = ok && dump(*gp).find("size:3/3 ttlSec:60 hits:4 misses:6") != std::string::npos;
+
+	gp->clearNegativeCache();
+	ok = ok && dump(*gp).find("size:0/3") != std::string::npos && lookup(3) == 7;
+
+	LOG(dump(*gp));
+	LOG("negative cache " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+// card registered in GUI after it was cached as not found is answered once sync brings it
+bool eraseOnSyncTest()
+{
+	boost::posix_time::ptime const start(boost::gregorian::date(2020, 1, 1));
+	std::unique_ptr<Clock> const clock = Clock::CreateSimulated(start);
+
+	RegisteringGui gui;
+	GuiProxy::Config config;
+	config.urls.push_back(gui.gui.url());
+	config.negativeCacheTtlSec = 600;
+	config.accountIndex = true;
+	config.accountSyncIntervalSec = 60;
+	config.clock = clock.get();
+	std::unique_ptr<GuiProxy> const gp = GuiProxy::CreateDefault(config);
+
+	auto const waitForIndex = [&](std::string const & state)
+	{
+		std::ostringstream index;
+		while (index.str().find(state) == std::string::npos)
+		{
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+			index.str("");
+			gp->dumpAccountIndex(index);
+		}
+	};
+	waitForIndex("loaded:1 version:1");
+
+	StandInCallback cb;
+	gp->handleRfidRequest(REGISTERED_RFID, 0, &cb);
+	bool ok = cb.waitForReply() == StandInCallback::NOT_FOUND;
+	gp->handleRfidRequest(REGISTERED_RFID, 0, &cb);
+	ok = ok && cb.waitForReply() == StandInCallback::NOT_FOUND && gui.lookups() == 1;
+
+	gui.registered = true;
+	clock->sleepFor(boost::posix_time::seconds(61));
+	waitForIndex("version:2");
+
+	gp->handleRfidRequest(REGISTERED_RFID, 0, &cb);
+	ok = ok && cb.waitForReply() == 50 && dump(*gp).find("size:0/") != std::string::npos;
+
+	LOG("negative cache erased on sync " << (ok ? "passed" : "FAILED"));
+	return ok;
+}
+
+int negativeCacheTestMain()
+{
+	try
+	{
+		log4cxx::BasicConfigurator::configure();
+		GuiProxy::GlobalInit();
+
+		bool const ok = negativeCacheTest() && eraseOnSyncTest();
+
+		GuiProxy::GlobalCleanup();
+		return ok ? 0 : 1;
+	}
+	catch(log4cxx::helpers::Exception&)
+	{
+		return 1;
+	}
+}
+
+}
+
+int main()
+{
+	return waterServer::negativeCacheTestMain();
+}
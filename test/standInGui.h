@@ -0,0 +1,280 @@
+#ifndef _STAND_IN_GUI
+#define _STAND_IN_GUI
+
+#include "../waterServer.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <boost/thread/scoped_thread.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/foreach.hpp>
+
+namespace waterServer
+{
+
+// Stand-in for GUI on localhost, answers every request with what the test's handler returns.
+// Connections are served one by one, so a delayed answer holds back the next request.
+class StandInGui
+{
+public:
+
+	struct Request
+	{
+		std::string name; // getuser_rfid, getusers, ...
+		std::string body;
+		bool binary; // body is GuiCodec encoded
+		bool acceptsBinary;
+	};
+
+	struct Answer
+	{
+		int status;
+		std::string body;
+		std::string contentType;
+		int delayMs;
+	};
+
+	typedef std::function<Answer(Request const &)> Handler;
+
+	StandInGui(Handler handlerArg) :
+		handler(handlerArg),
+		listenFd(::socket(AF_INET, SOCK_STREAM, 0)),
+		port(0),
+		accepting(true)
+	{
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t addrLen = sizeof(addr);
+		if (::bind(this->listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1 ||
+			::listen(this->listenFd, BACKLOG) == -1 ||
+			::getsockname(this->listenFd, reinterpret_cast<struct sockaddr *>(&addr), &addrLen) == -1)
+		{
+			throw std::runtime_error("can not listen for stand-in GUI");
+		}
+		this->port = ntohs(addr.sin_port);
+		this->worker = boost::scoped_thread<>{boost::thread(&StandInGui::workerMain, this)};
+	}
+
+	~StandInGui()
+	{
+		this->worker.interrupt();
+		this->worker.join();
+		this->setAccepting(true);
+		::close(this->listenFd);
+	}
+
+	// Not accepting, the listen backlog is filled up so further connects time out like on a dead uplink.
+	void setAccepting(bool const acceptingArg)
+	{
+		if (acceptingArg)
+		{
+			BOOST_FOREACH(int const fd, this->backlogFillers) ::close(fd);
+			this->backlogFillers.clear();
+			this->accepting = true;
+			return;
+		}
+
+		this->accepting = false;
+		boost::this_thread::sleep(boost::posix_time::milliseconds(200)); // worker leaves accept
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(this->port);
+		for (int i = 0; i < BACKLOG * 2; ++i)
+		{
+			int const fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+			::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+			this->backlogFillers.push_back(fd);
+		}
+	}
+
+	std::string url() const { return "http://127.0.0.1:" + boost::lexical_cast<std::string>(this->port); }
+
+	std::vector<Request> received()
+	{
+		boost::mutex::scoped_lock lck(this->mtx);
+		return this->requests;
+	}
+
+	// value of form parameter, or of the matching GuiCodec field for binary requests
+	static std::string Param(Request const & request, std::string const & name)
+	{
+		if (request.binary)
+		{
+			GuiCodec::Request decoded;
+			if (!GuiCodec::DecodeRequest(request.body, decoded)) return "";
+			if (name == "consumed_credit") return boost::lexical_cast<std::string>(decoded.consumedCredit);
+			if (name == "pin") return boost::lexical_cast<std::string>(decoded.pin);
+			return boost::lexical_cast<std::string>(decoded.id);
+		}
+
+		std::string const body = "&" + request.body;
+		std::string::size_type const at = body.find("&" + name + "=");
+		if (at == std::string::npos) return "";
+		std::string::size_type const from = at + name.size() + 2;
+		return body.substr(from, body.find('&', from) - from);
+	}
+
+	// credit consumed by the request, GuiProxy leaves the parameter out when nothing was consumed
+	static WaterClient::Credit Consumed(Request const & request)
+	{
+		std::string const consumed = Param(request, "consumed_credit");
+		return consumed.empty() ? 0 : boost::lexical_cast<WaterClient::Credit>(consumed);
+	}
+
+	static Answer Credit(Request const & request, WaterClient::Credit const credit, int const delayMs = 0)
+	{
+		if (request.acceptsBinary) return Answer{200, GuiCodec::EncodeCredit(credit), GuiCodec::BINARY_CONTENT_TYPE, delayMs};
+		return Answer{200, "{\"credit\":" + boost::lexical_cast<std::string>(credit) + "}", "application/json", delayMs};
+	}
+
+private:
+
+	static int const BACKLOG = 4;
+
+	Handler const handler;
+	int listenFd;
+	int port;
+	std::atomic<bool> accepting;
+	std::vector<int> backlogFillers; // connections nobody accepts
+	boost::mutex mtx;
+	std::vector<Request> requests;
+	boost::scoped_thread<> worker;
+
+	void workerMain()
+	{
+		while (true)
+		{
+			boost::this_thread::interruption_point();
+
+			struct pollfd pfd = { this->listenFd, POLLIN, 0 };
+			if (::poll(&pfd, 1, 100) <= 0) continue;
+			if (!this->accepting)
+			{
+				boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+				continue;
+			}
+
+			int const fd = ::accept(this->listenFd, nullptr, nullptr);
+			if (fd == -1) continue;
+			try
+			{
+				this->handleConnection(fd);
+			}
+			catch (boost::thread_interrupted const &)
+			{
+				::close(fd);
+				throw;
+			}
+			::close(fd);
+		}
+	}
+
+	static std::string header(std::string const & headers, std::string const & name)
+	{
+		std::string::size_type const at = headers.find("\r\n" + name + ": ");
+		if (at == std::string::npos) return "";
+		std::string::size_type const from = at + name.size() + 4;
+		return headers.substr(from, headers.find("\r\n", from) - from);
+	}
+
+	void handleConnection(int const fd)
+	{
+		std::string input;
+		char buf[512];
+		std::string::size_type headersEnd;
+		while ((headersEnd = input.find("\r\n\r\n")) == std::string::npos)
+		{
+			ssize_t const len = ::recv(fd, buf, sizeof(buf), 0);
+			if (len <= 0) return;
+			input.append(buf, len);
+		}
+
+		std::string const headers = input.substr(0, headersEnd + 2);
+		std::string const contentLength = header(headers, "Content-Length");
+		size_t const bodySize = contentLength.empty() ? 0 : boost::lexical_cast<size_t>(contentLength);
+		while (input.size() < headersEnd + 4 + bodySize)
+		{
+			ssize_t const len = ::recv(fd, buf, sizeof(buf), 0);
+			if (len <= 0) return;
+			input.append(buf, len);
+		}
+
+		// request line is "POST /<name> HTTP/1.1"
+		std::string::size_type const nameFrom = input.find('/') + 1;
+		Request const request{
+			input.substr(nameFrom, input.find(' ', nameFrom) - nameFrom),
+			input.substr(headersEnd + 4, bodySize),
+			header(headers, "Content-Type") == GuiCodec::BINARY_CONTENT_TYPE,
+			header(headers, "Accept").find(GuiCodec::BINARY_CONTENT_TYPE) != std::string::npos};
+		{
+			boost::mutex::scoped_lock lck(this->mtx);
+			this->requests.push_back(request);
+		}
+
+		Answer const answer = this->handler(request);
+		if (answer.delayMs > 0) boost::this_thread::sleep(boost::posix_time::milliseconds(answer.delayMs));
+
+		std::ostringstream osek;
+		osek << "HTTP/1.1 " << answer.status << " X\r\n"
+			<< "Content-Type: " << answer.contentType << "\r\n"
+			<< "Content-Length: " << answer.body.size() << "\r\n"
+			<< "Connection: close\r\n\r\n" << answer.body;
+		std::string const response = osek.str();
+		::send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+	}
+};
+
+// Waits for one GuiProxy answer, credit is -1 for serverInternalError and -2 for notFound.
+class StandInCallback : public GuiProxy::Callback
+{
+	bool replyHasCome;
+	WaterClient::Credit credit;
+	boost::mutex mtx;
+	boost::condition cnd;
+
+	void notifyThatWeHaveReply(WaterClient::Credit creditArg)
+	{
+		{
+			boost::mutex::scoped_lock lck(this->mtx);
+			this->replyHasCome = true;
+			this->credit = creditArg;
+		}
+		this->cnd.notify_all();
+	}
+
+	virtual void serverInternalError() { this->notifyThatWeHaveReply(-1); }
+	virtual void notFound() { this->notifyThatWeHaveReply(-2); }
+	virtual void success(WaterClient::Credit creditAvail) { this->notifyThatWeHaveReply(creditAvail); }
+
+public:
+
+	static WaterClient::Credit const SERVER_INTERNAL_ERROR = -1;
+	static WaterClient::Credit const NOT_FOUND = -2;
+
+	StandInCallback() : replyHasCome(false), credit(0) {}
+
+	WaterClient::Credit waitForReply()
+	{
+		boost::mutex::scoped_lock lck(this->mtx);
+		while(!this->replyHasCome) this->cnd.wait(lck);
+		this->replyHasCome = false;
+		return this->credit;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "waterServer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <boost/thread/mutex.hpp>
+#include <boost/foreach.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace waterServer
+{
+
+namespace
+{
+
+boost::mutex mtx;
+FILE * traceFile = nullptr;
+uint64_t lastTraceId = 0;
+
+struct Span
+{
+	char const * name;
+	RequestTrace::Stage from;
+	RequestTrace::Stage to;
+};
+
+Span const spans[] =
+{
+	{ "request", RequestTrace::POLL_START, RequestTrace::REPLY_WRITTEN },
+	{ "modbus read", RequestTrace::POLL_START, RequestTrace::REQUEST_READ },
+	{ "gui queue", RequestTrace::GUI_QUEUED, RequestTrace::GUI_SENT },
+	{ "gui http", RequestTrace::GUI_SENT, RequestTrace::GUI_ANSWERED },
+	{ "wait for poll", RequestTrace::REPLY_SET, RequestTrace::REPLY_PICKED_UP },
+	{ "reply write", RequestTrace::REPLY_PICKED_UP, RequestTrace::REPLY_WRITTEN },
+};
+
+}
+
+void
+RequestTrace::stamp(Stage const stage)
+{
+	if (this->id != 0) this->stampsUs[stage] = Tracer::NowUs();
+}
+
+void
+Tracer::Open(std::string const & path)
+{
+	boost::mutex::scoped_lock lck(mtx);
+	traceFile = fopen(path.c_str(), "a");
+	if (traceFile == nullptr)
+	{
+		ELOG("can not open trace file " << path << ", " << strerror(errno));
+		return;
+	}
+
+	// JSON array format, closing bracket is optional so the file can be appended forever
+	if (ftell(traceFile) == 0) fputs("[\n", traceFile);
+	LOG("tracing requests to " << path);
+}
+
+bool
+Tracer::Enabled()
+{
+	return traceFile != nullptr;
+}
+
+int64_t
+Tracer::NowUs()
+{
+	static boost::posix_time::ptime const epoch(boost::gregorian::date(1970, 1, 1));
+	return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+}
+
+void
+Tracer::Start(RequestTrace & trace, WaterClient::SlaveId const slaveId, int64_t const pollStartUs)
+{
+	if (!Enabled())
+	{
+		trace.id = 0;
+		return;
+	}
+
+	{
+		boost::mutex::scoped_lock lck(mtx);
+		trace.id = ++lastTraceId;
+	}
+	trace.slaveId = slaveId;
+	std::fill(trace.stampsUs, trace.stampsUs + RequestTrace::STAGES, 0);
+	trace.stampsUs[RequestTrace::POLL_START] = pollStartUs;
+	trace.stamp(RequestTrace::REQUEST_READ);
+}
+
+void
+Tracer::Finish(RequestTrace & trace)
+{
+	if (trace.id == 0) return;
+
+	boost::mutex::scoped_lock lck(mtx);
+	BOOST_FOREACH(Span const & span, spans)
+	{
+		int64_t const from = trace.stampsUs[span.from];
+		int64_t const to = trace.stampsUs[span.to];
+		if (from == 0 || to == 0) continue; // e.g. answered locally without GUI
+
+		fprintf(traceFile,
+			"{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%u,\"args\":{\"trace\":%llu}},\n",
+			span.name, static_cast<long long>(from), static_cast<long long>(to - from),
+			static_cast<int>(getpid()), static_cast<unsigned>(trace.slaveId),
+			static_cast<unsigned long long>(trace.id));
+	}
+	fflush(traceFile);
+	trace.id = 0;
+}
+
+}
@@ -20,11 +20,13 @@ static int pidFd = -1;
 #define PID_FILE_NAME "/var/run/waterServer.pid"
 
 int applicationMain(
-	std::string const & guiUrl,
+	GuiProxy::Config const & guiConfig,
+	ClientProxy::Config const & clientConfig,
 	std::list<WaterClient::SlaveId> const & slaveIds,
 	std::string const & device,
 	int baud, char parity, int dataBits, int stopBits,
-	int timeoutSec
+	int timeoutSec,
+	std::string const & controlSocketPath
 )
 {
 	GuiProxy::GlobalInit();
@@ -37,12 +39,15 @@ int applicationMain(
 
 		try
 		{
-			std::unique_ptr<GuiProxy> const guiProxy = GuiProxy::CreateDefault(guiUrl);
+			std::unique_ptr<GuiProxy> const guiProxy = GuiProxy::CreateDefault(guiConfig);
 			std::unique_ptr<ModbusServer> const modbusServer = ModbusServer::CreateDefault(
 				device.c_str(), baud, parity, dataBits, stopBits, timeoutSec
 			);
 			std::unique_ptr<ClientProxy> const clientProxy = ClientProxy::CreateDefault(
-				*guiProxy, *modbusServer, slaveIds);
+				*guiProxy, *modbusServer, slaveIds, clientConfig);
+			std::unique_ptr<ControlServer> const controlServer = controlSocketPath.empty() ?
+				std::unique_ptr<ControlServer>() :
+				ControlServer::CreateDefault(controlSocketPath, *guiProxy, *clientProxy);
 
 			LOG("starting application succeeded");
 			lastStartSucceeded = true;
@@ -57,7 +62,7 @@ int applicationMain(
 					lastStartSucceeded = false;
 			}
 			else { DLOG("server start failed, " << exc.what() << ", trying again..."); }
-			boost::this_thread::sleep(boost::posix_time::seconds(1));
+			Clock::Real().sleepFor(boost::posix_time::seconds(1));
 		}
 	}
 	GuiProxy::GlobalCleanup();
@@ -81,6 +86,18 @@ std::list<WaterClient::SlaveId> makeSlavesArray(std::string const & s)
   return result;
 }
 
+std::list<std::string> makeUrlsList(std::string const & s)
+{
+  std::list<std::string> result;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ','))
+  {
+	  if (!item.empty()) result.push_back(item);
+  }
+  return result;
+}
+
 void signalHandler(int sig)
 {
 	if (sig == SIGINT)
@@ -130,20 +147,43 @@ int main(int argc, char** argv)
 	boost::property_tree::ptree pt;
 	boost::property_tree::ini_parser::read_ini(argv[1], pt);
 
+	waterServer::GuiProxy::Config guiConfig;
+	guiConfig.urls = waterServer::makeUrlsList(pt.get<std::string>("guiurl"));
+	guiConfig.hedgeRequests = pt.get<bool>("guiHedge", false);
+	guiConfig.timeoutSec = pt.get<int>("guiTimeoutSec", 10);
+	guiConfig.negativeCacheSize = pt.get<size_t>("negativeCacheSize", 1024);
+	guiConfig.negativeCacheTtlSec = pt.get<int>("negativeCacheTtlSec", 60);
+	guiConfig.accountIndex = pt.get<bool>("accountIndex", false);
+	guiConfig.accountSyncIntervalSec = pt.get<int>("accountSyncIntervalSec", 60);
+	guiConfig.queueCapacity = pt.get<size_t>("guiQueueCapacity", 64);
+	guiConfig.maxQueueWaitSec = pt.get<int>("guiMaxQueueWaitSec", 20);
+
+	waterServer::ClientProxy::Config clientConfig;
+	clientConfig.pollIntervalMs = pt.get<int>("pollIntervalMs", 5000);
+	clientConfig.cpu = pt.get<int>("pollCpu", -1);
+	clientConfig.realtimePriority = pt.get<int>("pollRealtimePriority", 0);
+	clientConfig.lockMemory = pt.get<bool>("lockMemory", false);
+
 	try
 	{
 		log4cxx::PropertyConfigurator::configure(argv[2]);
 		syslog(LOG_INFO, "started waterServer");
 		LOG("started waterServer process, version:" << VERSION);
+
+		std::string const traceFile = pt.get<std::string>("traceFile", "");
+		if (!traceFile.empty()) waterServer::Tracer::Open(traceFile);
+
 		return waterServer::applicationMain(
-			pt.get<std::string>("guiurl"),
+			guiConfig,
+			clientConfig,
 			waterServer::makeSlavesArray(pt.get<std::string>("slaves")),
 			pt.get<std::string>("device"),
 			pt.get<int>("baud"),
 			pt.get<char>("parity"),
 			pt.get<int>("dataBits"),
 			pt.get<int>("stopBits"),
-			pt.get<int>("timeoutSec")
+			pt.get<int>("timeoutSec"),
+			pt.get<std::string>("controlSocket", "")
 		);
 	}
 	catch(log4cxx::helpers::Exception const &)
@@ -7,6 +7,10 @@
 #include <list>
 #include <memory> // unique_ptr
 #include <log4cxx/logger.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/optional.hpp>
 
 #define VERSION "1.0"
 
@@ -24,6 +28,97 @@ public:
 	std::string const & what() const  { return this->whatStr; }
 };
 
+// Time source of poll loop and GUI deadlines. Simulated clock lets tests and
+// benchmarks run hours of traffic in seconds, deterministically.
+class Clock
+{
+public:
+
+	virtual ~Clock();
+
+	virtual boost::posix_time::ptime now() = 0;
+
+	// Sleeping moves simulated time forward, used by the thread driving the simulation (poll loop).
+	virtual void sleepFor(boost::posix_time::time_duration) = 0;
+	virtual bool sleepUntil(boost::mutex::scoped_lock &, boost::condition &, boost::posix_time::ptime deadline) = 0;
+
+	// Waiting follows time moved by others, returns false on timeout.
+	virtual bool waitUntil(boost::mutex::scoped_lock &, boost::condition &, boost::posix_time::ptime deadline) = 0;
+
+	static Clock & Real(); // monotonic, not wall time
+	static std::unique_ptr<Clock> CreateSimulated(boost::posix_time::ptime start);
+};
+
+// Timestamps of one slave request, from reading it over Modbus to writing the reply back.
+struct RequestTrace
+{
+	enum Stage
+	{
+		POLL_START, REQUEST_READ, GUI_QUEUED, GUI_SENT, GUI_ANSWERED,
+		REPLY_SET, REPLY_PICKED_UP, REPLY_WRITTEN, STAGES
+	};
+
+	uint64_t id; // 0 when request is not traced
+	WaterClient::SlaveId slaveId;
+	int64_t stampsUs[STAGES];
+
+	void stamp(Stage);
+};
+
+// Writes finished request traces as Chrome trace events (chrome://tracing, Perfetto).
+class Tracer
+{
+public:
+
+	static void Open(std::string const & path);
+	static bool Enabled();
+	static int64_t NowUs();
+
+	static void Start(RequestTrace &, WaterClient::SlaveId, int64_t pollStartUs);
+	static void Finish(RequestTrace &);
+};
+
+// Compact alternative to form encoded requests and JSON answers of GUI, used with
+// endpoints that answer with BINARY_CONTENT_TYPE. Integers are little endian:
+//   request:         u8 format, u8 kind, u64 id (since version for ACCOUNTS), u64 pin, i32 consumed credit
+//   credit answer:   u8 format, i32 credit
+//   accounts answer: u8 format, u64 version, u32 count, count * {u64 id, u64 pin, u64 rfid, i32 credit, u8 flags}
+class GuiCodec
+{
+public:
+
+	static char const BINARY_CONTENT_TYPE[];
+
+	enum class RequestKind : uint8_t { ID_PIN = 1, RFID = 2, ACCOUNTS = 3 };
+
+	struct Request
+	{
+		RequestKind kind;
+		uint64_t id;
+		uint64_t pin;
+		WaterClient::Credit consumedCredit;
+	};
+
+	struct Account
+	{
+		WaterClient::UserId userId;
+		WaterClient::Pin pin;
+		boost::optional<WaterClient::RfidId> rfidId;
+		WaterClient::Credit credit;
+		bool deleted;
+	};
+
+	static std::string EncodeRequest(Request const &);
+	static bool DecodeRequest(std::string const & body, Request &);
+
+	static std::string EncodeCredit(WaterClient::Credit);
+	static std::string EncodeAccounts(uint64_t version, std::list<Account> const &);
+
+	// body is binary or JSON, false when it is malformed
+	static bool DecodeCredit(std::string const & body, bool binary, WaterClient::Credit &);
+	static bool DecodeAccounts(std::string const & body, bool binary, uint64_t & version, std::list<Account> &);
+};
+
 class GuiProxy
 {
 public:
@@ -36,6 +131,12 @@ public:
 		virtual void notFound() = 0;
 		virtual void success(WaterClient::Credit creditAvail) = 0;
 
+		// request shed or expired in overloaded queue, before it reached GUI
+		virtual void timeout() { this->serverInternalError(); }
+
+		// trace of request being handled, GUI stamps its stages there
+		virtual RequestTrace * trace() { return nullptr; }
+
 		virtual ~Callback();
 	};
 
@@ -43,7 +144,30 @@ public:
 	virtual void handleIdPinRequest(WaterClient::UserId, WaterClient::Pin, WaterClient::Credit creditToConsume, Callback*) = 0;
 	virtual void handleRfidRequest(WaterClient::RfidId, WaterClient::Credit creditToConsume, Callback*) = 0;
 
-	static std::unique_ptr<GuiProxy> CreateDefault(std::string const & guiUrl);
+	virtual void dumpQueue(std::ostream &) = 0;
+	virtual void dumpEndpoints(std::ostream &) = 0;
+	virtual void dumpNegativeCache(std::ostream &) = 0;
+	virtual void clearNegativeCache() = 0;
+	virtual void dumpAccountIndex(std::ostream &) = 0;
+
+	// queue is filling up, callers should hold back new requests until it drains
+	virtual bool isOverloaded() = 0;
+
+	struct Config
+	{
+		std::list<std::string> urls; // requests are routed to the healthiest, fastest one
+		bool hedgeRequests = false; // resend lookups to second endpoint when first is slower than its p95
+		int timeoutSec = 10;
+		size_t negativeCacheSize = 1024; // ids recently not found in GUI, 0 disables
+		int negativeCacheTtlSec = 60;
+		bool accountIndex = false; // answer known accounts locally, needs GUI getusers support
+		int accountSyncIntervalSec = 60;
+		size_t queueCapacity = 64; // oldest slave request is shed when full, consumption reports do not count
+		int maxQueueWaitSec = 20; // requests waiting longer are answered with timeout, not sent
+		Clock * clock = nullptr; // real clock when not given
+	};
+
+	static std::unique_ptr<GuiProxy> CreateDefault(Config const &);
 	static void GlobalInit();
 	static void GlobalCleanup();
 
@@ -69,9 +193,42 @@ public:
 
 	virtual ~ClientProxy();
 
-	static std::unique_ptr<ClientProxy> CreateDefault(GuiProxy &, ModbusServer &, std::list<WaterClient::SlaveId> const &);
+	struct Config
+	{
+		int pollIntervalMs = 5000; // between visits of consecutive slaves
+		Clock * clock = nullptr; // real clock when not given
+
+		// applied to poll thread by run(), threads started earlier (GUI, control) keep default scheduling
+		int cpu = -1; // cpu to pin poll thread to, -1 lets scheduler choose
+		int realtimePriority = 0; // SCHED_FIFO priority 1..99, 0 keeps normal scheduling
+		bool lockMemory = false; // mlockall, so poll thread never waits for a page fault
+	};
+
+	static std::unique_ptr<ClientProxy> CreateDefault(
+		GuiProxy &, ModbusServer &, std::list<WaterClient::SlaveId> const &, Config const &);
 
 	virtual void run() = 0;
+	virtual void runUntil(boost::posix_time::ptime deadline) = 0;
+
+	// visits every slave once without waiting between them, for tests and benchmarks
+	virtual void pollRound() = 0;
+
+	// control requests, safe to call from other threads
+	virtual void dumpSlaves(std::ostream &) = 0;
+	virtual bool pollNow(WaterClient::SlaveId) = 0;
+	virtual bool setPaused(WaterClient::SlaveId, bool paused) = 0;
+	virtual void dumpJitter(std::ostream &) = 0;
+	virtual void resetJitter() = 0;
+};
+
+class ControlServer
+{
+public:
+
+	virtual ~ControlServer();
+
+	// empty when the socket can not be set up, the server then runs without it
+	static std::unique_ptr<ControlServer> CreateDefault(std::string const & socketPath, GuiProxy &, ClientProxy &);
 };
 
 std::ostream & operator<<(std::ostream &, WaterClient::Request const &);